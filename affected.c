@@ -0,0 +1,265 @@
+/**
+ * affected.c - Finds the targets invalidated by a set of changed files.
+ *
+ * Every file and target named in the makefile gets a node holding the
+ * targets that depend on it. A query first collects the affected cone with
+ * a breadth-first walk from the changed files, then counts the edges
+ * inside the cone and prints it in topological order (Kahn's algorithm).
+ * Only nodes in the cone are touched, and their marks are cleared again
+ * afterwards, so the index can answer any number of queries.
+ *
+ * Functions:
+ *  - affected_index_new(): Builds the reverse-dependency index.
+ *  - affected_print(): Prints the targets that depend on changed files.
+ *  - affected_index_del(): Frees the index.
+ *  - get_node(): Finds or creates the node of a file.
+ *  - add_edges(): Records a target as a dependent of its prerequisites.
+ *  - add_dependent(): Records one dependent of a node.
+ *  - add_to_cone(): Marks a node as affected.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-27
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "affected.h"
+#include "strmap.h"
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct affected_node {
+	const char *name;
+	struct affected_node **dependents;
+	size_t n_dependents;
+	size_t cap;
+	size_t in_degree;
+	int in_cone;
+	struct affected_node *next_node;
+};
+
+struct affected_index {
+	strmap *nodes;
+	struct affected_node *all;
+	struct affected_node **cone;
+	size_t n_cone;
+	size_t cone_cap;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static struct affected_node *get_node(affected_index *index, const char *name);
+static int add_edges(affected_index *index, struct affected_node *target, const char **prereq);
+static int add_dependent(struct affected_node *node, struct affected_node *dependent);
+static int add_to_cone(affected_index *index, struct affected_node *node);
+
+/* -------------------------- External functions -------------------------- */
+
+affected_index *affected_index_new(makefile *mmakefile, deps_log *deps) {
+	affected_index *index = calloc(1, sizeof *index);
+	if(index == NULL) {
+		return NULL;
+	}
+	if((index->nodes = strmap_new()) == NULL) {
+		free(index);
+		return NULL;
+	}
+
+	for(rule *r = makefile_first_rule(mmakefile); r != NULL; r = rule_next(r)) {
+		const char *name = rule_target(r);
+
+		// Only the rule mmake would use for the target counts
+		if(name[0] == '.' || makefile_rule(mmakefile, name) != r) {
+			continue;
+		}
+
+		struct affected_node *target = get_node(index, name);
+		const char **discovered = deps != NULL ? deps_log_get(deps, name) : NULL;
+		if(target == NULL || add_edges(index, target, rule_prereq(r)) == 1
+				|| (discovered != NULL && add_edges(index, target, discovered) == 1)) {
+			affected_index_del(index);
+			return NULL;
+		}
+	}
+	return index;
+}
+
+int affected_print(affected_index *index, char **files, int n_files, FILE *out) {
+	int result = 0;
+	index->n_cone = 0;
+
+	// Collect every target reachable from the changed files
+	for(int i = 0; i < n_files; i++) {
+		struct affected_node *node = strmap_get(index->nodes, files[i]);
+		for(size_t d = 0; node != NULL && d < node->n_dependents; d++) {
+			if(add_to_cone(index, node->dependents[d]) == 1) {
+				result = 1;
+			}
+		}
+	}
+	for(size_t i = 0; i < index->n_cone; i++) {
+		struct affected_node *node = index->cone[i];
+		for(size_t d = 0; d < node->n_dependents; d++) {
+			if(add_to_cone(index, node->dependents[d]) == 1) {
+				result = 1;
+			}
+		}
+	}
+
+	// Count the prerequisites of each target that are affected themselves
+	for(size_t i = 0; i < index->n_cone; i++) {
+		struct affected_node *node = index->cone[i];
+		for(size_t d = 0; d < node->n_dependents; d++) {
+			node->dependents[d]->in_degree++;
+		}
+	}
+
+	// Order targets after all their affected prerequisites
+	struct affected_node **order = malloc((index->n_cone + 1) * sizeof *order);
+	if(order != NULL && result == 0) {
+		size_t head = 0;
+		size_t tail = 0;
+		for(size_t i = 0; i < index->n_cone; i++) {
+			if(index->cone[i]->in_degree == 0) {
+				order[tail++] = index->cone[i];
+			}
+		}
+		while(head < tail) {
+			struct affected_node *node = order[head++];
+			for(size_t d = 0; d < node->n_dependents; d++) {
+				if(--node->dependents[d]->in_degree == 0) {
+					order[tail++] = node->dependents[d];
+				}
+			}
+		}
+
+		// Print nothing unless the order covers the cone, so a cycle
+		// leaves no partial list behind
+		if(tail < index->n_cone) {
+			result = 2;
+		} else {
+			for(size_t i = 0; i < tail; i++) {
+				fprintf(out, "%s\n", order[i]->name);
+			}
+		}
+	} else {
+		result = 1;
+	}
+	free(order);
+
+	// Clear the marks so the next query starts afresh
+	for(size_t i = 0; i < index->n_cone; i++) {
+		index->cone[i]->in_cone = 0;
+		index->cone[i]->in_degree = 0;
+	}
+	index->n_cone = 0;
+	return result;
+}
+
+void affected_index_del(affected_index *index) {
+	if(index == NULL) {
+		return;
+	}
+	struct affected_node *node = index->all;
+	while(node != NULL) {
+		struct affected_node *next = node->next_node;
+		free(node->dependents);
+		free(node);
+		node = next;
+	}
+	strmap_del(index->nodes);
+	free(index->cone);
+	free(index);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Finds the node of a file, creating it if it does not exist yet.
+ *
+ * @param index	The index.
+ * @param name	Name of the file. It must outlive the index.
+ * @return		The node, or NULL if out of memory.
+ */
+static struct affected_node *get_node(affected_index *index, const char *name) {
+	struct affected_node *node = strmap_get(index->nodes, name);
+	if(node != NULL) {
+		return node;
+	}
+	if((node = calloc(1, sizeof *node)) == NULL) {
+		return NULL;
+	}
+	node->name = name;
+	if(strmap_put(index->nodes, name, node) == 1) {
+		free(node);
+		return NULL;
+	}
+	node->next_node = index->all;
+	index->all = node;
+	return node;
+}
+
+/**
+ * Records a target as a dependent of each of its prerequisites.
+ *
+ * @param index		The index.
+ * @param target	Node of the target.
+ * @param prereq	The prerequisites, terminated with NULL.
+ * @return			0 on success, 1 if out of memory.
+ */
+static int add_edges(affected_index *index, struct affected_node *target, const char **prereq) {
+	for(int i = 0; prereq[i] != NULL; i++) {
+		struct affected_node *node = get_node(index, prereq[i]);
+		if(node == NULL || add_dependent(node, target) == 1) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Appends a dependent to a node.
+ *
+ * @param node		The node depended on.
+ * @param dependent	The node that depends on it.
+ * @return			0 on success, 1 if out of memory.
+ */
+static int add_dependent(struct affected_node *node, struct affected_node *dependent) {
+	if(node->n_dependents == node->cap) {
+		size_t cap = node->cap != 0 ? node->cap * 2 : 4;
+		struct affected_node **dependents = realloc(node->dependents, cap * sizeof *dependents);
+		if(dependents == NULL) {
+			return 1;
+		}
+		node->dependents = dependents;
+		node->cap = cap;
+	}
+	node->dependents[node->n_dependents++] = dependent;
+	return 0;
+}
+
+/**
+ * Adds a node to the affected cone unless it is already in it.
+ *
+ * @param index	The index.
+ * @param node	The affected node.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int add_to_cone(affected_index *index, struct affected_node *node) {
+	if(node->in_cone) {
+		return 0;
+	}
+	if(index->n_cone == index->cone_cap) {
+		size_t cap = index->cone_cap != 0 ? index->cone_cap * 2 : 64;
+		struct affected_node **cone = realloc(index->cone, cap * sizeof *cone);
+		if(cone == NULL) {
+			return 1;
+		}
+		index->cone = cone;
+		index->cone_cap = cap;
+	}
+	node->in_cone = 1;
+	index->cone[index->n_cone++] = node;
+	return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * affected.h - Finds the targets invalidated by a set of changed files.
+ *
+ * The index maps every file to the targets that list it as a prerequisite,
+ * either in the makefile or through a depfile recorded in the deps log. A
+ * query walks this reverse graph from the changed files, so its cost is
+ * linear in the number of affected targets and their edges rather than in
+ * the size of the whole makefile.
+ *
+ * Functions:
+ *  - affected_index_new(): Builds the reverse-dependency index.
+ *  - affected_print(): Prints the targets that depend on changed files.
+ *  - affected_index_del(): Frees the index.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-27
+ * @Version:	1.0
+ */
+
+#ifndef AFFECTED_H
+#define AFFECTED_H
+
+#include <stdio.h>
+#include "parser.h"
+#include "deps.h"
+
+typedef struct affected_index affected_index;
+
+/**
+ * Builds the reverse-dependency index of a makefile. Special targets are
+ * left out. The caller is responsible for freeing the index with
+ * affected_index_del, before the makefile and deps log are freed.
+ *
+ * @param mmakefile	The parsed makefile.
+ * @param deps		The deps log, or NULL to ignore discovered prerequisites.
+ * @return			The index, or NULL if out of memory.
+ */
+affected_index *affected_index_new(makefile *mmakefile, deps_log *deps);
+
+/**
+ * Prints, one per line and in build order, every target that depends
+ * directly or transitively on one of the changed files. A changed file
+ * that is itself a target is only printed if it depends on another
+ * changed file.
+ *
+ * @param index		The reverse-dependency index.
+ * @param files		The changed files.
+ * @param n_files	Number of changed files.
+ * @param out		Where to print the targets.
+ * @return			0 on success, 1 if memory ran out, 2 if the affected
+ *					targets form a cycle. Nothing is printed on error.
+ */
+int affected_print(affected_index *index, char **files, int n_files, FILE *out);
+
+/**
+ * Frees the memory of an index.
+ *
+ * @param index	The index, or NULL.
+ */
+void affected_index_del(affected_index *index);
+
+#endif
@@ -0,0 +1,365 @@
+/**
+ * artifact.c - Local content-addressed cache of build outputs.
+ *
+ * Each cache entry is a small text manifest named after the key. The key
+ * is the digest of the target, the command words and, for each declared
+ * prerequisite, its name and the digest of its contents, each field ended
+ * by a NUL. The manifest starts with a version line, then names the stored
+ * output by the digest of its contents, then lists one discovered
+ * prerequisite per line as the digest of its contents, a space and its
+ * path. Outputs are kept as objects named after their digest, so entries
+ * with the same output share one copy. Manifests and objects are written
+ * to a temporary file in the cache directory and renamed into place, and
+ * restored targets are written next to the target and renamed over it, so
+ * readers never observe a partial file. Files are cloned with FICLONE when
+ * possible; hard links are deliberately not used, since a later rebuild
+ * that rewrites the target in place would then corrupt the shared entry.
+ *
+ * Functions:
+ *  - artifact_key(): Computes the cache key of a target.
+ *  - artifact_restore(): Restores a target from the cache.
+ *  - artifact_store(): Stores a freshly built target in the cache.
+ *  - hash_prereqs(): Feeds the names and contents of files into a key.
+ *  - hex_digest(): Computes the digest of a file's contents in hexadecimal.
+ *  - to_hex(): Formats a digest in hexadecimal.
+ *  - read_manifest(): Reads a manifest and checks its discovered files.
+ *  - write_manifest(): Atomically writes the manifest of an entry.
+ *  - clone_file(): Copies a file into an open file, via reflink if possible.
+ *  - clone_to(): Atomically replaces a path with a clone of a file.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-22
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "artifact.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define COPY_CHUNK 65536
+#define MANIFEST_VERSION "mmake-artifact 1"
+#define OBJECT_SUFFIX ".obj"
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void hash_prereqs(sha256_ctx *ctx, const char **prereq);
+static int hex_digest(const char *path, char hex[ARTIFACT_KEY_LEN + 1]);
+static void to_hex(const unsigned char digest[SHA256_LEN], char hex[ARTIFACT_KEY_LEN + 1]);
+static int read_manifest(const char *entry, char object[ARTIFACT_KEY_LEN + 1], char ***discovered);
+static int write_manifest(const char *dir, const char *entry, const char *object,
+	const char **discovered);
+static int clone_file(int src_fd, int dst_fd);
+static int clone_to(const char *src, const char *dst, const char *tmp_dir);
+
+/* -------------------------- External functions -------------------------- */
+
+void artifact_key(const char *target, char **cmd, const char **prereq, char key[ARTIFACT_KEY_LEN + 1]) {
+	sha256_ctx ctx;
+	unsigned char digest[SHA256_LEN];
+	sha256_init(&ctx);
+	sha256_update(&ctx, target, strlen(target) + 1);
+
+	for(int index = 0; cmd[index] != NULL; index++) {
+		sha256_update(&ctx, cmd[index], strlen(cmd[index]) + 1);
+	}
+
+	// Separate the command from the prerequisites, then add their contents
+	sha256_update(&ctx, "", 1);
+	hash_prereqs(&ctx, prereq);
+	sha256_final(&ctx, digest);
+	to_hex(digest, key);
+}
+
+int artifact_restore(const char *dir, const char *target, const char *key, char ***discovered) {
+	char entry[strlen(dir) + ARTIFACT_KEY_LEN + 2];
+	char object_hex[ARTIFACT_KEY_LEN + 1];
+	snprintf(entry, sizeof entry, "%s/%s", dir, key);
+	if(read_manifest(entry, object_hex, discovered) == 1) {
+		return 1;
+	}
+
+	char object[strlen(dir) + ARTIFACT_KEY_LEN + sizeof OBJECT_SUFFIX + 1];
+	snprintf(object, sizeof object, "%s/%s" OBJECT_SUFFIX, dir, object_hex);
+
+	// Temporary file goes in the target's directory, so rename stays atomic
+	char tmp_dir[strlen(target) + 1];
+	strcpy(tmp_dir, target);
+	char *slash = strrchr(tmp_dir, '/');
+	if(slash != NULL) {
+		*slash = '\0';
+	} else {
+		strcpy(tmp_dir, ".");
+	}
+	if(clone_to(object, target, tmp_dir) == 1) {
+		free(*discovered);
+		return 1;
+	}
+	return 0;
+}
+
+int artifact_store(const char *dir, const char *target, const char *key, const char **discovered) {
+	struct stat st;
+	char object_hex[ARTIFACT_KEY_LEN + 1];
+	const char *none[] = {NULL};
+	if(stat(target, &st) == -1 || !S_ISREG(st.st_mode) || hex_digest(target, object_hex) == 1) {
+		return 1;
+	}
+
+	char object[strlen(dir) + ARTIFACT_KEY_LEN + sizeof OBJECT_SUFFIX + 1];
+	snprintf(object, sizeof object, "%s/%s" OBJECT_SUFFIX, dir, object_hex);
+	if(access(object, F_OK) == -1 && clone_to(target, object, dir) == 1) {
+		return 1;
+	}
+
+	char entry[strlen(dir) + ARTIFACT_KEY_LEN + 2];
+	snprintf(entry, sizeof entry, "%s/%s", dir, key);
+	return write_manifest(dir, entry, object_hex, discovered != NULL ? discovered : none);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Feeds the names and the digests of the contents of a list of files into
+ * a key.
+ *
+ * @param ctx		The key being computed.
+ * @param prereq	The files, terminated with NULL.
+ */
+static void hash_prereqs(sha256_ctx *ctx, const char **prereq) {
+	for(int index = 0; prereq[index] != NULL; index++) {
+		unsigned char digest[SHA256_LEN];
+		sha256_update(ctx, prereq[index], strlen(prereq[index]) + 1);
+		if(sha256_file(prereq[index], digest) == 0) {
+			sha256_update(ctx, digest, sizeof digest);
+		}
+	}
+}
+
+/**
+ * Computes the digest of the contents of a file, in hexadecimal.
+ *
+ * @param path	The file.
+ * @param hex	Filled with the NUL-terminated digest.
+ * @return		0 on success, 1 if the file could not be read.
+ */
+static int hex_digest(const char *path, char hex[ARTIFACT_KEY_LEN + 1]) {
+	unsigned char digest[SHA256_LEN];
+	if(sha256_file(path, digest) == 1) {
+		return 1;
+	}
+	to_hex(digest, hex);
+	return 0;
+}
+
+/**
+ * Formats a digest in hexadecimal.
+ *
+ * @param digest	The digest.
+ * @param hex		Filled with the NUL-terminated digest.
+ */
+static void to_hex(const unsigned char digest[SHA256_LEN], char hex[ARTIFACT_KEY_LEN + 1]) {
+	for(int i = 0; i < SHA256_LEN; i++) {
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	}
+}
+
+/**
+ * Reads the manifest of a cache entry and checks that every discovered
+ * prerequisite it lists still has the recorded contents.
+ *
+ * @param entry			Path of the manifest.
+ * @param object		Filled with the digest naming the stored output.
+ * @param discovered	On success, filled with the discovered prerequisites,
+ *						terminated with NULL, in one block freed with free().
+ * @return				0 if the entry is usable, 1 on a miss, a changed or
+ *						missing prerequisite, or error.
+ */
+static int read_manifest(const char *entry, char object[ARTIFACT_KEY_LEN + 1], char ***discovered) {
+	FILE *f = fopen(entry, "r");
+	if(f == NULL) {
+		return 1;
+	}
+
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	char *paths = NULL;
+	size_t paths_len = 0;
+	size_t n_paths = 0;
+	int failed = 0;
+
+	// Version line, then the object line
+	len = getline(&line, &cap, f);
+	failed = len == -1 || strcmp(line, MANIFEST_VERSION "\n") != 0;
+	if(!failed) {
+		len = getline(&line, &cap, f);
+		failed = len != ARTIFACT_KEY_LEN + 1 || strspn(line, "0123456789abcdef") != ARTIFACT_KEY_LEN;
+	}
+	if(!failed) {
+		memcpy(object, line, ARTIFACT_KEY_LEN);
+		object[ARTIFACT_KEY_LEN] = '\0';
+	}
+
+	while(!failed && (len = getline(&line, &cap, f)) != -1) {
+		char hex[ARTIFACT_KEY_LEN + 1];
+		if(len < ARTIFACT_KEY_LEN + 3 || line[ARTIFACT_KEY_LEN] != ' ' || line[len - 1] != '\n') {
+			failed = 1;
+			break;
+		}
+		line[len - 1] = '\0';
+		const char *path = line + ARTIFACT_KEY_LEN + 1;
+		size_t path_len = len - ARTIFACT_KEY_LEN - 1;
+		if(hex_digest(path, hex) == 1 || memcmp(hex, line, ARTIFACT_KEY_LEN) != 0) {
+			failed = 1;
+			break;
+		}
+
+		char *grown = realloc(paths, paths_len + path_len);
+		if(grown == NULL) {
+			failed = 1;
+			break;
+		}
+		paths = grown;
+		memcpy(paths + paths_len, path, path_len);
+		paths_len += path_len;
+		n_paths++;
+	}
+	failed = failed || ferror(f);
+	free(line);
+	fclose(f);
+
+	// Pack the list and its strings into one block
+	char **list = failed ? NULL : malloc((n_paths + 1) * sizeof *list + paths_len);
+	if(list == NULL) {
+		free(paths);
+		return 1;
+	}
+	char *strings = (char *)(list + n_paths + 1);
+	if(paths_len > 0) {
+		memcpy(strings, paths, paths_len);
+	}
+	for(size_t i = 0; i < n_paths; i++) {
+		list[i] = strings;
+		strings += strlen(strings) + 1;
+	}
+	list[n_paths] = NULL;
+	free(paths);
+	*discovered = list;
+	return 0;
+}
+
+/**
+ * Atomically writes the manifest of a cache entry, replacing any earlier
+ * one. Nothing is written if a discovered prerequisite cannot be read, or
+ * its name cannot be kept on one line.
+ *
+ * @param dir			The cache directory.
+ * @param entry			Path of the manifest.
+ * @param object		Digest naming the stored output.
+ * @param discovered	The discovered prerequisites, terminated with NULL.
+ * @return				0 on success, otherwise 1
+ */
+static int write_manifest(const char *dir, const char *entry, const char *object,
+		const char **discovered) {
+	char tmp_path[strlen(dir) + 20];
+	snprintf(tmp_path, sizeof tmp_path, "%s/.mmake-XXXXXX", dir);
+	int fd = mkstemp(tmp_path);
+	FILE *f = fd != -1 ? fdopen(fd, "w") : NULL;
+	if(f == NULL) {
+		if(fd != -1) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		return 1;
+	}
+
+	int failed = 0;
+	fprintf(f, "%s\n%s\n", MANIFEST_VERSION, object);
+	for(int index = 0; !failed && discovered[index] != NULL; index++) {
+		char hex[ARTIFACT_KEY_LEN + 1];
+		failed = strchr(discovered[index], '\n') != NULL || hex_digest(discovered[index], hex) == 1;
+		if(!failed) {
+			fprintf(f, "%s %s\n", hex, discovered[index]);
+		}
+	}
+	if(fclose(f) == EOF || failed || rename(tmp_path, entry) == -1) {
+		unlink(tmp_path);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Copies the contents of one open file into another, sharing the data
+ * blocks with a reflink when the filesystem supports it.
+ *
+ * @param src_fd	File to copy from.
+ * @param dst_fd	Empty file to copy into.
+ * @return			0 on success, otherwise 1
+ */
+static int clone_file(int src_fd, int dst_fd) {
+	char buf[COPY_CHUNK];
+	ssize_t n;
+
+	if(ioctl(dst_fd, FICLONE, src_fd) == 0) {
+		return 0;
+	}
+
+	while((n = read(src_fd, buf, sizeof buf)) > 0) {
+		char *p = buf;
+		while(n > 0) {
+			ssize_t written = write(dst_fd, p, n);
+			if(written == -1) {
+				return 1;
+			}
+			p += written;
+			n -= written;
+		}
+	}
+	return n == -1;
+}
+
+/**
+ * Atomically replaces a path with a clone of a file, by cloning into a
+ * temporary file and renaming it over the destination.
+ *
+ * @param src		File to clone.
+ * @param dst		Path to replace.
+ * @param tmp_dir	Directory for the temporary file, on the same
+ *					filesystem as dst.
+ * @return			0 on success, otherwise 1
+ */
+static int clone_to(const char *src, const char *dst, const char *tmp_dir) {
+	struct stat st;
+	int src_fd = open(src, O_RDONLY);
+	if(src_fd == -1) {
+		return 1;
+	}
+
+	char tmp_path[strlen(tmp_dir) + 20];
+	snprintf(tmp_path, sizeof tmp_path, "%s/.mmake-XXXXXX", tmp_dir);
+	int dst_fd = mkstemp(tmp_path);
+	if(dst_fd == -1) {
+		close(src_fd);
+		return 1;
+	}
+
+	int failed = clone_file(src_fd, dst_fd);
+	if(!failed && fstat(src_fd, &st) == 0) {
+		fchmod(dst_fd, st.st_mode & 0777);
+	}
+	close(src_fd);
+	if(close(dst_fd) == -1 || failed || rename(tmp_path, dst) == -1) {
+		unlink(tmp_path);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * artifact.h - Local content-addressed cache of build outputs.
+ *
+ * When enabled, the output of every rebuilt target is stored in a cache
+ * directory under a key derived from the target, its command line and the
+ * contents of its declared prerequisites. The entry also lists the
+ * prerequisites discovered from the target's depfile, with the digests of
+ * their contents. A later build that would run the same command on the
+ * same inputs, with every discovered prerequisite unchanged, restores the
+ * stored file instead of running the command. Keys are SHA-256 digests,
+ * so a crafted input cannot be made to share the key of another and
+ * restore its output. Entries are written atomically, so several mmake
+ * processes can share one cache directory.
+ *
+ * Functions:
+ *  - artifact_key(): Computes the cache key of a target.
+ *  - artifact_restore(): Restores a target from the cache.
+ *  - artifact_store(): Stores a freshly built target in the cache.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-22
+ * @Version:	1.0
+ */
+
+#ifndef ARTIFACT_H
+#define ARTIFACT_H
+
+#include "sha256.h"
+
+/* Length of a cache key: the digest in hexadecimal, without the NUL. */
+#define ARTIFACT_KEY_LEN (2 * SHA256_LEN)
+
+/**
+ * Computes the cache key of a target from its name, its command line and
+ * the contents of its declared prerequisites. Prerequisites that are not
+ * files contribute only their name. Discovered prerequisites are not part
+ * of the key, since they are only known once the target has been built;
+ * they are checked against the cache entry on restore instead.
+ *
+ * @param target	Name of the target.
+ * @param cmd		The command, and its arguments, used to build the target.
+ * @param prereq	The declared prerequisites of the target.
+ * @param key		Filled with the NUL-terminated cache key.
+ */
+void artifact_key(const char *target, char **cmd, const char **prereq, char key[ARTIFACT_KEY_LEN + 1]);
+
+/**
+ * Restores a target from the cache, if every prerequisite discovered when
+ * it was stored still has the contents it had then. The file is cloned
+ * with a reflink where the filesystem supports it and copied otherwise,
+ * then renamed over the target.
+ *
+ * @param dir			The cache directory.
+ * @param target		Name of the target.
+ * @param key			The cache key of the target.
+ * @param discovered	On success, filled with the discovered prerequisites
+ *						of the stored target, terminated with NULL. The list
+ *						and its strings are one block, freed with free().
+ * @return				0 if the target was restored, 1 on a cache miss or
+ *						error.
+ */
+int artifact_restore(const char *dir, const char *target, const char *key, char ***discovered);
+
+/**
+ * Stores a freshly built target in the cache, along with the digests of
+ * the prerequisites discovered from its depfile. Targets that are not
+ * regular files, or whose discovered prerequisites cannot be read, are
+ * not stored. An existing entry under the same key is replaced.
+ *
+ * @param dir			The cache directory.
+ * @param target		Name of the target.
+ * @param key			The cache key of the target.
+ * @param discovered	Prerequisites discovered from a depfile, or NULL.
+ * @return				0 if the target was stored, otherwise 1
+ */
+int artifact_store(const char *dir, const char *target, const char *key, const char **discovered);
+
+#endif
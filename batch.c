@@ -0,0 +1,364 @@
+/**
+ * batch.c - Folds stale targets of batchable rules into shared commands.
+ *
+ * A family is identified by a key built from the command words that are
+ * not inputs, plus the position the inputs are inserted at. Each family
+ * has at most one open batch at a time; once a batch is taken to be run,
+ * later stale targets of the family start a new one. All batches stay
+ * owned by the set until it is freed, so lookups never see freed memory.
+ *
+ * Functions:
+ *  - batch_set_new(): Creates the batch state for a makefile.
+ *  - batch_defer(): Defers a stale target to the batch of its family.
+ *  - batch_pending(): Checks whether a target is waiting in a batch.
+ *  - batch_take(): Removes the batch holding a target from the set.
+ *  - batch_take_any(): Removes any batch that is still waiting.
+ *  - batch_next_cmd(): Produces the next command of a taken batch.
+ *  - batch_set_del(): Frees the batch state.
+ *  - is_input(): Checks whether a command word is a prerequisite.
+ *  - family_key(): Builds the family key of a rule.
+ *  - new_group(): Creates an empty batch for a family.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-24
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "batch.h"
+#include "strmap.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+/* Separates the words of a family key; cannot appear in a parsed word. */
+#define KEY_SEP '\n'
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct batch_group {
+	char *key;
+	char **template;
+	size_t n_template;
+	size_t slot;
+	const char **targets;
+	rule **rules;
+	size_t n_targets;
+	size_t cap;
+	size_t next;
+	size_t arg_budget;
+	int taken;
+	batch_group *next_group;
+};
+
+struct batch_set {
+	strmap *batchable;
+	strmap *families;
+	strmap *pending;
+	batch_group *groups;
+	batch_group *last;
+	size_t arg_budget;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int is_input(const char *word, rule *r);
+static char *family_key(rule *r, size_t *slot);
+static batch_group *new_group(batch_set *set, char *key, rule *r, size_t slot);
+
+/* -------------------------- External functions -------------------------- */
+
+batch_set *batch_set_new(makefile *mmakefile) {
+	batch_set *set = calloc(1, sizeof *set);
+	if(set == NULL) {
+		return NULL;
+	}
+	set->batchable = strmap_new();
+	set->families = strmap_new();
+	set->pending = strmap_new();
+	if(set->batchable == NULL || set->families == NULL || set->pending == NULL) {
+		batch_set_del(set);
+		return NULL;
+	}
+
+	// Leave half of the argument space to the environment
+	long arg_max = sysconf(_SC_ARG_MAX);
+	set->arg_budget = arg_max > 0 ? (size_t)arg_max / 2 : 65536;
+
+	// A rule holds only so many prerequisites, so .BATCH may be repeated
+	for(rule *r = makefile_first_rule(mmakefile); r != NULL; r = rule_next(r)) {
+		if(strcmp(rule_target(r), BATCH_TARGET) != 0) {
+			continue;
+		}
+		const char **prereq = rule_prereq(r);
+		for(int index = 0; prereq[index] != NULL; index++) {
+			if(strmap_put(set->batchable, prereq[index], set) == 1) {
+				batch_set_del(set);
+				return NULL;
+			}
+		}
+	}
+	return set;
+}
+
+int batch_defer(batch_set *set, const char *target, rule *r) {
+	size_t slot;
+	if(strmap_get(set->batchable, target) == NULL) {
+		return 0;
+	}
+
+	char *key = family_key(r, &slot);
+	if(key == NULL) {
+		return 0;
+	}
+
+	batch_group *group = strmap_get(set->families, key);
+	if(group == NULL || group->taken) {
+		if((group = new_group(set, key, r, slot)) == NULL) {
+			free(key);
+			return 0;
+		}
+	} else {
+		free(key);
+	}
+
+	if(group->n_targets == group->cap) {
+		size_t cap = group->cap != 0 ? group->cap * 2 : 16;
+		const char **targets = realloc(group->targets, cap * sizeof *targets);
+		if(targets != NULL) {
+			group->targets = targets;
+		}
+		rule **rules = realloc(group->rules, cap * sizeof *rules);
+		if(rules != NULL) {
+			group->rules = rules;
+		}
+		if(targets == NULL || rules == NULL) {
+			return 0;
+		}
+		group->cap = cap;
+	}
+
+	if(strmap_put(set->pending, rule_target(r), group) == 1) {
+		return 0;
+	}
+	group->targets[group->n_targets] = rule_target(r);
+	group->rules[group->n_targets] = r;
+	group->n_targets++;
+	return 1;
+}
+
+int batch_pending(batch_set *set, const char *target) {
+	batch_group *group = strmap_get(set->pending, target);
+	return group != NULL && !group->taken;
+}
+
+batch_group *batch_take(batch_set *set, const char *target) {
+	if(!batch_pending(set, target)) {
+		return NULL;
+	}
+	batch_group *group = strmap_get(set->pending, target);
+	group->taken = 1;
+	return group;
+}
+
+batch_group *batch_take_any(batch_set *set) {
+	for(batch_group *group = set->groups; group != NULL; group = group->next_group) {
+		if(!group->taken && group->n_targets > 0) {
+			group->taken = 1;
+			return group;
+		}
+	}
+	return NULL;
+}
+
+char **batch_next_cmd(batch_group *group, const char ***targets, rule ***rules, size_t *n_targets) {
+	if(group->next >= group->n_targets) {
+		return NULL;
+	}
+
+	size_t size = 0;
+	for(size_t i = 0; i < group->n_template; i++) {
+		size += strlen(group->template[i]) + 1 + sizeof(char *);
+	}
+
+	// Take whole targets while their inputs fit in the argument budget
+	size_t first = group->next;
+	size_t n_inputs = 0;
+	size_t end = first;
+	while(end < group->n_targets) {
+		size_t target_size = 0;
+		size_t target_inputs = 0;
+		char **cmd = rule_cmd(group->rules[end]);
+		for(int index = 0; cmd[index] != NULL; index++) {
+			if(is_input(cmd[index], group->rules[end])) {
+				target_size += strlen(cmd[index]) + 1 + sizeof(char *);
+				target_inputs++;
+			}
+		}
+		if(end > first && size + target_size > group->arg_budget) {
+			break;
+		}
+		size += target_size;
+		n_inputs += target_inputs;
+		end++;
+	}
+
+	char **argv = malloc((group->n_template + n_inputs + 1) * sizeof *argv);
+	if(argv == NULL) {
+		return NULL;
+	}
+	size_t n = 0;
+	for(size_t i = 0; i < group->slot; i++) {
+		argv[n++] = group->template[i];
+	}
+	for(size_t t = first; t < end; t++) {
+		char **cmd = rule_cmd(group->rules[t]);
+		for(int index = 0; cmd[index] != NULL; index++) {
+			if(is_input(cmd[index], group->rules[t])) {
+				argv[n++] = cmd[index];
+			}
+		}
+	}
+	for(size_t i = group->slot; i < group->n_template; i++) {
+		argv[n++] = group->template[i];
+	}
+	argv[n] = NULL;
+
+	*targets = group->targets + first;
+	*rules = group->rules + first;
+	*n_targets = end - first;
+	group->next = end;
+	return argv;
+}
+
+void batch_set_del(batch_set *set) {
+	if(set == NULL) {
+		return;
+	}
+	batch_group *group = set->groups;
+	while(group != NULL) {
+		batch_group *next = group->next_group;
+		free(group->key);
+		free(group->template);
+		free(group->targets);
+		free(group->rules);
+		free(group);
+		group = next;
+	}
+	strmap_del(set->batchable);
+	strmap_del(set->families);
+	strmap_del(set->pending);
+	free(set);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Checks whether a command word is one of the prerequisites of a rule.
+ *
+ * @param word	The command word.
+ * @param r		The rule.
+ * @return		1 if the word is a prerequisite, otherwise 0
+ */
+static int is_input(const char *word, rule *r) {
+	const char **prereq = rule_prereq(r);
+	for(int index = 0; prereq[index] != NULL; index++) {
+		if(strcmp(prereq[index], word) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Builds the family key of a rule: the position of its inputs followed by
+ * its command words that are not inputs. Only a command whose inputs form
+ * one run of words can have them replaced by those of other targets
+ * without reordering the command. The key should be freed using free.
+ *
+ * @param r		The rule.
+ * @param slot	Filled with the position the inputs are inserted at.
+ * @return		The key, or NULL if the command has no inputs or they are
+ *				split by other words.
+ */
+static char *family_key(rule *r, size_t *slot) {
+	char **cmd = rule_cmd(r);
+	size_t len = 32;
+	size_t n_template = 0;
+	int found = 0;
+
+	for(int index = 0; cmd[index] != NULL; index++) {
+		if(is_input(cmd[index], r)) {
+			if(!found) {
+				*slot = n_template;
+				found = 1;
+			} else if(n_template != *slot) {
+				return NULL;
+			}
+		} else {
+			len += strlen(cmd[index]) + 1;
+			n_template++;
+		}
+	}
+	if(!found) {
+		return NULL;
+	}
+
+	char *key = malloc(len);
+	if(key == NULL) {
+		return NULL;
+	}
+	char *p = key + sprintf(key, "%zu", *slot);
+	for(int index = 0; cmd[index] != NULL; index++) {
+		if(!is_input(cmd[index], r)) {
+			*p++ = KEY_SEP;
+			p = stpcpy(p, cmd[index]);
+		}
+	}
+	return key;
+}
+
+/**
+ * Creates an empty batch for a family and makes it the family's open one.
+ *
+ * @param set	The batch state.
+ * @param key	The family key, owned by the batch on success.
+ * @param r		A rule of the family, providing the command template.
+ * @param slot	The position the inputs are inserted at.
+ * @return		The batch, or NULL if out of memory.
+ */
+static batch_group *new_group(batch_set *set, char *key, rule *r, size_t slot) {
+	char **cmd = rule_cmd(r);
+	size_t n_words = 0;
+	while(cmd[n_words] != NULL) {
+		n_words++;
+	}
+
+	batch_group *group = calloc(1, sizeof *group);
+	if(group == NULL) {
+		return NULL;
+	}
+	group->template = malloc((n_words + 1) * sizeof *group->template);
+	if(group->template == NULL || strmap_put(set->families, key, group) == 1) {
+		free(group->template);
+		free(group);
+		return NULL;
+	}
+	for(int index = 0; cmd[index] != NULL; index++) {
+		if(!is_input(cmd[index], r)) {
+			group->template[group->n_template++] = cmd[index];
+		}
+	}
+	group->key = key;
+	group->slot = slot;
+	group->arg_budget = set->arg_budget;
+	if(set->last == NULL) {
+		set->groups = group;
+	} else {
+		set->last->next_group = group;
+	}
+	set->last = group;
+	return group;
+}
@@ -0,0 +1,111 @@
+/**
+ * batch.h - Folds stale targets of batchable rules into shared commands.
+ *
+ * Rules are marked batchable by listing their targets as prerequisites of
+ * the special target .BATCH, which may be given more than once:
+ *
+ *      .BATCH: a.o b.o c.o
+ *
+ * The inputs of a batchable rule are the words of its command that are
+ * also its prerequisites, and must follow each other in the command; a
+ * rule whose inputs are split by other words is built on its own. Rules
+ * whose commands are identical once their inputs are removed form a
+ * family, e.g. "gcc -c a.c" and "gcc -c b.c".
+ * Instead of running such a rule when its target is stale, the target is
+ * deferred to a batch of its family, and the whole batch is later run as
+ * one command with all inputs in place of the single one ("gcc -c a.c
+ * b.c"). Batches are split so that no command exceeds the system's
+ * argument size limit.
+ *
+ * Functions:
+ *  - batch_set_new(): Creates the batch state for a makefile.
+ *  - batch_defer(): Defers a stale target to the batch of its family.
+ *  - batch_pending(): Checks whether a target is waiting in a batch.
+ *  - batch_take(): Removes the batch holding a target from the set.
+ *  - batch_take_any(): Removes any batch that is still waiting.
+ *  - batch_next_cmd(): Produces the next command of a taken batch.
+ *  - batch_set_del(): Frees the batch state.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-24
+ * @Version:	1.0
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "parser.h"
+
+/* Name of the special target listing batchable targets. */
+#define BATCH_TARGET ".BATCH"
+
+typedef struct batch_set batch_set;
+typedef struct batch_group batch_group;
+
+/**
+ * Creates the batch state for a makefile. The caller is responsible for
+ * freeing it with batch_set_del.
+ *
+ * @param mmakefile	The parsed makefile.
+ * @return			The batch state, or NULL if out of memory.
+ */
+batch_set *batch_set_new(makefile *mmakefile);
+
+/**
+ * Defers a stale target to the batch of its family, if its rule is
+ * batchable.
+ *
+ * @param set		The batch state.
+ * @param target	The stale target.
+ * @param r			The rule of the target.
+ * @return			1 if the target was deferred, 0 if it must be built now.
+ */
+int batch_defer(batch_set *set, const char *target, rule *r);
+
+/**
+ * Checks whether a target has been deferred and is still waiting.
+ *
+ * @param set		The batch state.
+ * @param target	The target.
+ * @return			1 if the target is waiting in a batch, otherwise 0
+ */
+int batch_pending(batch_set *set, const char *target);
+
+/**
+ * Removes the batch holding a target from the set, so it can be run.
+ *
+ * @param set		The batch state.
+ * @param target	The target.
+ * @return			The batch, or NULL if the target is not waiting.
+ */
+batch_group *batch_take(batch_set *set, const char *target);
+
+/**
+ * Removes any batch that is still waiting from the set.
+ *
+ * @param set	The batch state.
+ * @return		A batch, or NULL if none is waiting.
+ */
+batch_group *batch_take_any(batch_set *set);
+
+/**
+ * Produces the next command of a taken batch. The command array should be
+ * freed using free; its strings belong to the makefile.
+ *
+ * @param group		The batch.
+ * @param targets	Filled with the targets built by the command.
+ * @param rules		Filled with the rules of those targets.
+ * @param n_targets	Filled with the number of targets.
+ * @return			NULL-terminated command, or NULL when the batch is done.
+ */
+char **batch_next_cmd(batch_group *group, const char ***targets, rule ***rules, size_t *n_targets);
+
+/**
+ * Frees the batch state, including all batches taken from it.
+ *
+ * @param set	The batch state, or NULL.
+ */
+void batch_set_del(batch_set *set);
+
+#endif
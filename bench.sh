@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# bench.sh - Times mmake on synthetic makefiles made by benchgen.
+#
+# For every shape and size, times parsing alone, a full build where every
+# command is "true", and, with commands that touch their targets, a full
+# build, a no-op build and an incremental build after
+# touching one leaf.
+# Results are written as CSV (shape,rules,phase,seconds) to
+# bench_output.txt.
+#
+# Environment:
+#      BENCH_SIZES	: Rule counts to run (default "1000 10000").
+#      BENCH_LARGE	: Set to 1 to also run 1000000 rules.
+#      BENCH_CHAIN_MAX	: Longest chain to generate (default 10000), since
+#					  mmake recurses once per chain link.
+#      BENCH_LATTICE_MAX	: Largest lattice to generate (default 1000), since
+#					  every path through a lattice is walked separately.
+#      BENCH_OUT		: Output file (default bench_output.txt).
+#
+# Author: Rasmus
+# Date: 2025-10-26
+
+set -e
+
+top=$(pwd)
+mmake="$top/mmake"
+benchgen="$top/benchgen"
+sizes=${BENCH_SIZES:-"1000 10000"}
+chain_max=${BENCH_CHAIN_MAX:-10000}
+lattice_max=${BENCH_LATTICE_MAX:-1000}
+out=${BENCH_OUT:-"$top/bench_output.txt"}
+
+if [ "$BENCH_LARGE" = 1 ]; then
+	sizes="$sizes 1000000"
+fi
+
+# Prints the current time in nanoseconds.
+now() {
+	date +%s%N
+}
+
+# Runs mmake with the given arguments and records the elapsed time.
+# Usage: timed SHAPE RULES PHASE ARGS...
+timed() {
+	shape=$1 rules=$2 phase=$3
+	shift 3
+	start=$(now)
+	"$mmake" -s "$@" > /dev/null
+	end=$(now)
+	secs=$(echo "$start $end" | awk '{ printf "%.6f", ($2 - $1) / 1e9 }')
+	echo "$shape,$rules,$phase,$secs" >> "$out"
+	echo "$shape $rules $phase: ${secs}s"
+}
+
+echo "shape,rules,phase,seconds" > "$out"
+for shape in chain wide lattice long; do
+	for rules in $sizes; do
+		if [ "$shape" = chain ] && [ "$rules" -gt "$chain_max" ]; then
+			continue
+		fi
+		if [ "$shape" = lattice ] && [ "$rules" -gt "$lattice_max" ]; then
+			continue
+		fi
+
+		# Commands that do nothing: every run rebuilds every target
+		dir=$(mktemp -d)
+		(cd "$dir" && "$benchgen" $shape $rules true > mmakefile)
+		(cd "$dir" && timed $shape $rules parse -f mmakefile parse-only)
+		(cd "$dir" && timed $shape $rules full_true -f mmakefile all)
+		rm -rf "$dir"
+
+		# Commands that touch their target: later runs are incremental
+		dir=$(mktemp -d)
+		(cd "$dir" && "$benchgen" $shape $rules touch > mmakefile)
+		(cd "$dir" && timed $shape $rules full_touch -f mmakefile all)
+		(cd "$dir" && timed $shape $rules noop -f mmakefile all)
+		# Make sure the touched leaf is newer even with second timestamps
+		sleep 1
+		touch "$dir/leaf0"
+		(cd "$dir" && timed $shape $rules incremental -f mmakefile all)
+		rm -rf "$dir"
+	done
+done
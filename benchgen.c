@@ -0,0 +1,280 @@
+/**
+ * benchgen.c - Generates synthetic mmakefiles for benchmarking.
+ *
+ * Writes a makefile with a given shape and number of rules to stdout, and
+ * creates the leaf files it depends on in the current directory. Every
+ * generated makefile has a target "all" depending on everything, and a
+ * target "parse-only" with no prerequisites, used to time parsing.
+ *
+ * Synopsis:
+ *      ./benchgen SHAPE RULES CMD > MAKEFILE
+ *
+ * Shapes:
+ *      chain	: n0 depends on n1, which depends on n2, ... down to one leaf.
+ *      wide	: RULES independent rules, each depending on one leaf, fanned
+ *				  in to "all" through a tree of group rules.
+ *      lattice	: Layers of nodes where each node depends on two nodes of the
+ *				  layer below, so the same nodes are reached by many paths.
+ *      long	: RULES independent rules, each with the longest prerequisite
+ *				  list the parser accepts.
+ *      batch	: RULES batchable rules n0 ... nN-1, each passing its leaf to
+ *				  CMD, so that they fold into shared commands. Through "all"
+ *				  each group rule flushes its own 32; given as goals on the
+ *				  command line, enough of them (about 70000 with the default
+ *				  stack limit) exceed the argument budget of one command and
+ *				  the batch is split.
+ *
+ * CMD is the command of every rule. The special value "touch" makes each
+ * rule touch its own target, so later runs find it up to date. In the
+ * batch shape CMD is instead given the rule's leaf as its last argument,
+ * and the targets are never created.
+ *
+ * Author: Rasmus
+ * Date: 2025-10-26
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parser.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define MAX_LEAVES 1024
+#define LATTICE_DEPTH 8
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void print_rule(const char *target, const char *cmd);
+static void make_leaves(long n_leaves);
+static void fan_in(const char *prefix, long n_items, const char *cmd);
+static void gen_chain(long n_rules, const char *cmd);
+static void gen_wide(long n_rules, const char *cmd);
+static void gen_lattice(long n_rules, const char *cmd);
+static void gen_long(long n_rules, const char *cmd);
+static void gen_batch(long n_rules, const char *cmd);
+
+/* -------------------------- External functions -------------------------- */
+
+/**
+ * Entry point of the generator.
+ *
+ * @param argc	Argument count
+ * @param argv	Argument vector
+ * @return		0 on success, non-zero on error
+ */
+int main(int argc, char **argv) {
+	if(argc != 4 || atol(argv[2]) < 1) {
+		fprintf(stderr, "usage: %s chain|wide|lattice|long|batch RULES CMD\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	long n_rules = atol(argv[2]);
+	const char *cmd = argv[3];
+
+	printf("parse-only:\n\ttrue\n\n");
+	if(strcmp(argv[1], "chain") == 0) {
+		gen_chain(n_rules, cmd);
+	} else if(strcmp(argv[1], "wide") == 0) {
+		gen_wide(n_rules, cmd);
+	} else if(strcmp(argv[1], "lattice") == 0) {
+		gen_lattice(n_rules, cmd);
+	} else if(strcmp(argv[1], "long") == 0) {
+		gen_long(n_rules, cmd);
+	} else if(strcmp(argv[1], "batch") == 0) {
+		gen_batch(n_rules, cmd);
+	} else {
+		fprintf(stderr, "%s: unknown shape\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Prints the command line of the rule currently being written.
+ *
+ * @param target	The target of the rule.
+ * @param cmd		The command, or "touch" to touch the target.
+ */
+static void print_rule(const char *target, const char *cmd) {
+	if(strcmp(cmd, "touch") == 0) {
+		printf("\ttouch %s\n\n", target);
+	} else {
+		printf("\t%s\n\n", cmd);
+	}
+}
+
+/**
+ * Creates the leaf files leaf0 ... leafN-1 in the current directory.
+ *
+ * @param n_leaves	Number of leaves.
+ */
+static void make_leaves(long n_leaves) {
+	char name[32];
+	for(long i = 0; i < n_leaves; i++) {
+		snprintf(name, sizeof name, "leaf%ld", i);
+		FILE *fp = fopen(name, "a");
+		if(fp == NULL) {
+			perror(name);
+			exit(EXIT_FAILURE);
+		}
+		fclose(fp);
+	}
+}
+
+/**
+ * Makes "all" depend on the targets PREFIX0 ... PREFIXN-1, through a tree
+ * of group rules so that no rule exceeds the prerequisite limit.
+ *
+ * @param prefix	Name prefix of the targets.
+ * @param n_items	Number of targets.
+ * @param cmd		Command of every group rule.
+ */
+static void fan_in(const char *prefix, long n_items, const char *cmd) {
+	char item_prefix[32];
+	char level_prefix[32];
+	char target[64];
+	int level = 0;
+
+	snprintf(item_prefix, sizeof item_prefix, "%s", prefix);
+	while(n_items > MAX_PREREQ) {
+		long n_groups = (n_items + MAX_PREREQ - 1) / MAX_PREREQ;
+		snprintf(level_prefix, sizeof level_prefix, "g%d_", level);
+		for(long g = 0; g < n_groups; g++) {
+			snprintf(target, sizeof target, "%s%ld", level_prefix, g);
+			printf("%s:", target);
+			for(long i = g * MAX_PREREQ; i < n_items && i < (g + 1) * MAX_PREREQ; i++) {
+				printf(" %s%ld", item_prefix, i);
+			}
+			printf("\n");
+			print_rule(target, cmd);
+		}
+		strcpy(item_prefix, level_prefix);
+		n_items = n_groups;
+		level++;
+	}
+
+	printf("all:");
+	for(long i = 0; i < n_items; i++) {
+		printf(" %s%ld", item_prefix, i);
+	}
+	printf("\n");
+	print_rule("all", cmd);
+}
+
+/**
+ * Generates a single chain of rules ending in one leaf.
+ *
+ * @param n_rules	Number of rules in the chain.
+ * @param cmd		Command of every rule.
+ */
+static void gen_chain(long n_rules, const char *cmd) {
+	char target[32];
+	make_leaves(1);
+	for(long i = 0; i < n_rules; i++) {
+		snprintf(target, sizeof target, "n%ld", i);
+		if(i + 1 < n_rules) {
+			printf("%s: n%ld\n", target, i + 1);
+		} else {
+			printf("%s: leaf0\n", target);
+		}
+		print_rule(target, cmd);
+	}
+	fan_in("n", 1, cmd);
+}
+
+/**
+ * Generates independent rules each depending on one leaf.
+ *
+ * @param n_rules	Number of rules.
+ * @param cmd		Command of every rule.
+ */
+static void gen_wide(long n_rules, const char *cmd) {
+	char target[32];
+	long n_leaves = n_rules < MAX_LEAVES ? n_rules : MAX_LEAVES;
+	make_leaves(n_leaves);
+	for(long i = 0; i < n_rules; i++) {
+		snprintf(target, sizeof target, "n%ld", i);
+		printf("%s: leaf%ld\n", target, i % n_leaves);
+		print_rule(target, cmd);
+	}
+	fan_in("n", n_rules, cmd);
+}
+
+/**
+ * Generates a lattice of LATTICE_DEPTH layers. Node w of a layer depends
+ * on nodes w and w+1 of the layer below, the bottom layer on leaves.
+ *
+ * @param n_rules	Approximate number of rules.
+ * @param cmd		Command of every rule.
+ */
+static void gen_lattice(long n_rules, const char *cmd) {
+	char target[32];
+	long width = n_rules / LATTICE_DEPTH > 1 ? n_rules / LATTICE_DEPTH : 2;
+	long n_leaves = width < MAX_LEAVES ? width : MAX_LEAVES;
+	make_leaves(n_leaves);
+
+	for(int layer = 0; layer < LATTICE_DEPTH; layer++) {
+		for(long w = 0; w < width; w++) {
+			snprintf(target, sizeof target, "l%d_%ld", layer, w);
+			if(layer + 1 < LATTICE_DEPTH) {
+				printf("%s: l%d_%ld l%d_%ld\n", target, layer + 1, w, layer + 1, (w + 1) % width);
+			} else {
+				printf("%s: leaf%ld\n", target, w % n_leaves);
+			}
+			print_rule(target, cmd);
+		}
+	}
+	fan_in("l0_", width, cmd);
+}
+
+/**
+ * Generates independent rules with the longest prerequisite lists the
+ * parser accepts.
+ *
+ * @param n_rules	Number of rules.
+ * @param cmd		Command of every rule.
+ */
+static void gen_long(long n_rules, const char *cmd) {
+	char target[32];
+	make_leaves(MAX_LEAVES);
+	for(long i = 0; i < n_rules; i++) {
+		snprintf(target, sizeof target, "n%ld", i);
+		printf("%s:", target);
+		for(long p = 0; p < MAX_PREREQ; p++) {
+			printf(" leaf%ld", (i * MAX_PREREQ + p) % MAX_LEAVES);
+		}
+		printf("\n");
+		print_rule(target, cmd);
+	}
+	fan_in("n", n_rules, cmd);
+}
+
+/**
+ * Generates independent rules each depending on one leaf, listed under
+ * .BATCH and passing their leaf to the same command.
+ *
+ * @param n_rules	Number of rules.
+ * @param cmd		Command of every rule, without its input.
+ */
+static void gen_batch(long n_rules, const char *cmd) {
+	char target[32];
+	long n_leaves = n_rules < MAX_LEAVES ? n_rules : MAX_LEAVES;
+	make_leaves(n_leaves);
+	for(long i = 0; i < n_rules; i++) {
+		snprintf(target, sizeof target, "n%ld", i);
+		printf("%s: leaf%ld\n", target, i % n_leaves);
+		printf("\t%s leaf%ld\n\n", cmd, i % n_leaves);
+	}
+
+	// A rule holds only so many prerequisites, so .BATCH is repeated
+	for(long i = 0; i < n_rules; i += MAX_PREREQ) {
+		printf(".BATCH:");
+		for(long p = i; p < n_rules && p < i + MAX_PREREQ; p++) {
+			printf(" n%ld", p);
+		}
+		printf("\n\n");
+	}
+	fan_in("n", n_rules, cmd);
+}
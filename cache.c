@@ -0,0 +1,584 @@
+/**
+ * cache.c - Pre-compiled binary images of parsed makefiles.
+ *
+ * Layout of an image (all offsets are relative to the start of the image,
+ * which makes the image relocatable):
+ *
+ *      header | rule table | slots | index | strings
+ *
+ * Each entry in the rule table holds the offset of its target string and
+ * the offsets of its prerequisite and command arrays in the slot area. A
+ * slot holds the offset of a string, or 0 as array terminator. Identical
+ * strings are stored once. The index is the strmap table from targets to
+ * rules, saved with the offset of each target and the position of its
+ * rule, so loading does not hash every target again. When an image is
+ * loaded it is mapped privately and every slot and index entry is
+ * rewritten in place into real pointers, so the arrays can be handed to
+ * the rest of mmake as ordinary NULL-terminated arrays and the index used
+ * as it is.
+ *
+ * An image is used if the makefile has the size and modification time
+ * recorded in it. The contents are only hashed when the time differs, or
+ * is so close to when the image was written that the makefile may have
+ * changed again within the same tick, and when an image is written.
+ *
+ * Functions:
+ *  - cache_key_init(): Computes the key identifying a makefile's contents.
+ *  - cache_load(): Loads the image matching a key, if there is one.
+ *  - cache_store(): Writes the image of a parsed makefile.
+ *  - image_path(): Builds the path of the image for a makefile.
+ *  - key_hash(): Hashes the contents of the makefile of a key.
+ *  - same_source(): Checks that an image was built from a key's makefile.
+ *  - valid_header(): Checks that an image is well formed.
+ *  - relocate(): Turns the slots of a mapped image into pointers.
+ *  - load_index(): Turns the index of a mapped image into a map.
+ *  - buf_append(): Appends bytes to a growable buffer.
+ *  - intern(): Stores a string once in the string area.
+ *  - put_array(): Stores a NULL-terminated string array as slots.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-21
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "hash.h"
+#include "strmap.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define IMAGE_MAGIC "MMKIMAGE"
+#define IMAGE_VERSION 2
+#define READ_CHUNK 65536
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct image_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t ptr_size;
+	uint64_t image_size;
+	uint64_t src_size;
+	int64_t src_mtime_sec;
+	int64_t src_mtime_nsec;
+	uint64_t src_hash;
+	uint64_t path;
+	uint64_t n_rules;
+	uint64_t n_slots;
+	uint64_t index;
+	uint64_t index_capacity;
+	uint64_t index_count;
+	uint64_t strings;
+};
+
+struct image_rule {
+	uint64_t target;
+	uint64_t prereq;
+	uint64_t cmd;
+};
+
+/* An index entry; rewritten in place into a strmap_entry when loaded. */
+struct image_index_entry {
+	uint64_t target;
+	uint64_t rule;
+	uint64_t hash;
+};
+
+_Static_assert(sizeof(strmap_entry) <= sizeof(struct image_index_entry),
+	"index entries must be relocatable in place");
+
+struct buffer {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static char *image_path(const char *path);
+static int key_hash(cache_key *key);
+static int same_source(const struct image_header *h, cache_key *key, const struct stat *image_st);
+static int valid_header(const struct image_header *h, const cache_key *key, size_t size);
+static int relocate(char *base, const struct image_header *h);
+static strmap *load_index(char *base, const struct image_header *h, makefile *mmakefile);
+static int buf_append(struct buffer *buf, const void *data, size_t len);
+static int intern(struct buffer *strings, strmap *seen, uint64_t base, const char *str, uint64_t *offset);
+static int put_array(struct buffer *slots, struct buffer *strings, strmap *seen, uint64_t base, char **arr);
+
+/* -------------------------- External functions -------------------------- */
+
+int cache_key_init(cache_key *key, const char *path, FILE *fp) {
+	struct stat st;
+	if(fstat(fileno(fp), &st) == -1) {
+		return 1;
+	}
+
+	key->path = path;
+	key->fp = fp;
+	key->size = st.st_size;
+	key->mtime_sec = st.st_mtim.tv_sec;
+	key->mtime_nsec = st.st_mtim.tv_nsec;
+	key->hash = 0;
+	key->hashed = 0;
+	return 0;
+}
+
+makefile *cache_load(cache_key *key) {
+	struct stat st;
+	char *path = image_path(key->path);
+	if(path == NULL) {
+		return NULL;
+	}
+
+	// Writable if possible, so the recorded modification time can be renewed
+	int fd = open(path, O_RDWR);
+	if(fd == -1) {
+		fd = open(path, O_RDONLY);
+	}
+	free(path);
+	if(fd == -1) {
+		return NULL;
+	}
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct image_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	// Private writable mapping, so slots can be relocated without touching the file
+	size_t size = st.st_size;
+	char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if(base == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	const struct image_header *h = (const struct image_header *)base;
+	int source = valid_header(h, key, size) ? same_source(h, key, &st) : 0;
+	if(source == 2) {
+		// Only the time differed, so record the new one for the next load
+		int64_t mtime[2] = { key->mtime_sec, key->mtime_nsec };
+		pwrite(fd, mtime, sizeof mtime, offsetof(struct image_header, src_mtime_sec));
+	}
+	close(fd);
+	if(source == 0 || relocate(base, h) == 1) {
+		munmap(base, size);
+		return NULL;
+	}
+
+	makefile *mmakefile = makefile_new(base, size);
+	if(mmakefile == NULL) {
+		munmap(base, size);
+		return NULL;
+	}
+
+	const struct image_rule *rules = (const struct image_rule *)(base + sizeof *h);
+	for(uint64_t i = 0; i < h->n_rules; i++) {
+		if(makefile_add_rule(mmakefile, base + rules[i].target, (char **)(base + rules[i].prereq),
+				(char **)(base + rules[i].cmd)) == 1) {
+			makefile_del(mmakefile);
+			return NULL;
+		}
+	}
+
+	strmap *index = load_index(base, h, mmakefile);
+	if(index == NULL) {
+		makefile_del(mmakefile);
+		return NULL;
+	}
+	makefile_set_index(mmakefile, index);
+	return mmakefile;
+}
+
+int cache_store(cache_key *key, makefile *mmakefile) {
+	struct image_header h;
+	struct buffer rules = {0};
+	struct buffer slots = {0};
+	struct buffer index = {0};
+	struct buffer strings = {0};
+	int result = 1;
+
+	strmap *seen = strmap_new();
+	strmap *targets = strmap_new();
+	char *path = image_path(key->path);
+	char *tmp_path = path != NULL ? malloc(strlen(path) + 8) : NULL;
+	if(seen == NULL || targets == NULL || tmp_path == NULL || key_hash(key) == 1) {
+		goto out;
+	}
+
+	// Count rules and slots and build the index first, so the offset of
+	// the string area is known
+	uint64_t n_rules = 0;
+	uint64_t n_slots = 0;
+	for(rule *r = makefile_first_rule(mmakefile); r != NULL; r = rule_next(r)) {
+		for(const char **p = rule_prereq(r); *p != NULL; p++) {
+			n_slots++;
+		}
+		for(char **p = rule_cmd(r); *p != NULL; p++) {
+			n_slots++;
+		}
+		n_slots += 2;
+		n_rules++;
+		if(strmap_get(targets, rule_target(r)) == NULL && strmap_put(targets, rule_target(r), r) == 1) {
+			goto out;
+		}
+	}
+	size_t capacity;
+	const strmap_entry *table = strmap_table(targets, &capacity);
+	uint64_t slots_base = sizeof h + n_rules * sizeof(struct image_rule);
+	uint64_t index_base = slots_base + n_slots * sizeof(uint64_t);
+	uint64_t strings_base = index_base + capacity * sizeof(struct image_index_entry);
+
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, IMAGE_MAGIC, sizeof h.magic);
+	h.version = IMAGE_VERSION;
+	h.ptr_size = sizeof(char *);
+	h.src_size = key->size;
+	h.src_mtime_sec = key->mtime_sec;
+	h.src_mtime_nsec = key->mtime_nsec;
+	h.src_hash = key->hash;
+	h.n_rules = n_rules;
+	h.n_slots = n_slots;
+	h.index = index_base;
+	h.index_capacity = capacity;
+	h.index_count = strmap_count(targets);
+	h.strings = strings_base;
+	if(intern(&strings, seen, strings_base, key->path, &h.path) == 1) {
+		goto out;
+	}
+
+	for(rule *r = makefile_first_rule(mmakefile); r != NULL; r = rule_next(r)) {
+		struct image_rule ir;
+		if(intern(&strings, seen, strings_base, rule_target(r), &ir.target) == 1) {
+			goto out;
+		}
+		ir.prereq = slots_base + slots.len;
+		if(put_array(&slots, &strings, seen, strings_base, (char **)rule_prereq(r)) == 1) {
+			goto out;
+		}
+		ir.cmd = slots_base + slots.len;
+		if(put_array(&slots, &strings, seen, strings_base, rule_cmd(r)) == 1
+				|| buf_append(&rules, &ir, sizeof ir) == 1) {
+			goto out;
+		}
+	}
+	for(size_t i = 0; i < capacity; i++) {
+		struct image_index_entry ie = {0};
+		if(table[i].key != NULL) {
+			ie.rule = rule_index(table[i].value);
+			ie.hash = table[i].hash;
+			if(intern(&strings, seen, strings_base, table[i].key, &ie.target) == 1) {
+				goto out;
+			}
+		}
+		if(buf_append(&index, &ie, sizeof ie) == 1) {
+			goto out;
+		}
+	}
+	h.image_size = strings_base + strings.len;
+
+	// Write to a temporary file and rename it into place atomically
+	sprintf(tmp_path, "%s.XXXXXX", path);
+	int fd = mkstemp(tmp_path);
+	if(fd == -1) {
+		goto out;
+	}
+	FILE *out = fdopen(fd, "wb");
+	if(out == NULL) {
+		close(fd);
+		unlink(tmp_path);
+		goto out;
+	}
+	fwrite(&h, sizeof h, 1, out);
+	fwrite(rules.data, 1, rules.len, out);
+	fwrite(slots.data, 1, slots.len, out);
+	fwrite(index.data, 1, index.len, out);
+	fwrite(strings.data, 1, strings.len, out);
+	int write_failed = ferror(out);
+	if(fclose(out) != 0 || write_failed || rename(tmp_path, path) == -1) {
+		unlink(tmp_path);
+		goto out;
+	}
+	result = 0;
+
+out:
+	free(rules.data);
+	free(slots.data);
+	free(index.data);
+	free(strings.data);
+	strmap_del(seen);
+	strmap_del(targets);
+	free(tmp_path);
+	free(path);
+	return result;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Builds the path of the image belonging to a makefile.
+ *
+ * @param path	Path of the makefile.
+ * @return		Allocated path of the image, or NULL if out of memory.
+ */
+static char *image_path(const char *path) {
+	char *result = malloc(strlen(path) + sizeof CACHE_SUFFIX);
+	if(result != NULL) {
+		sprintf(result, "%s%s", path, CACHE_SUFFIX);
+	}
+	return result;
+}
+
+/**
+ * Hashes the contents of the makefile of a key, unless already done. The
+ * file is read from the start and rewound, so it can still be parsed.
+ *
+ * @param key	The key.
+ * @return		0 on success, 1 if the file could not be read.
+ */
+static int key_hash(cache_key *key) {
+	unsigned char buf[READ_CHUNK];
+	size_t n;
+	if(key->hashed) {
+		return 0;
+	}
+
+	rewind(key->fp);
+	uint64_t hash = HASH_INIT;
+	while((n = fread(buf, 1, sizeof buf, key->fp)) > 0) {
+		hash = hash_bytes(hash, buf, n);
+	}
+	if(ferror(key->fp)) {
+		return 1;
+	}
+	rewind(key->fp);
+
+	key->hash = hash;
+	key->hashed = 1;
+	return 0;
+}
+
+/**
+ * Checks that an image was built from the current contents of the makefile
+ * of a key. A matching size and modification time are trusted, unless the
+ * makefile was modified no earlier than the image was written, since it
+ * may then have changed again within the same timestamp tick. Otherwise
+ * the contents are hashed and compared.
+ *
+ * @param h			Header of the mapped image.
+ * @param key		Key of the makefile.
+ * @param image_st	Status of the image file.
+ * @return			1 if the image matches the makefile by time, 2 if by the
+ *					hash of its contents, otherwise 0
+ */
+static int same_source(const struct image_header *h, cache_key *key, const struct stat *image_st) {
+	if(h->src_size != key->size) {
+		return 0;
+	}
+	if(h->src_mtime_sec == key->mtime_sec && h->src_mtime_nsec == key->mtime_nsec
+			&& (key->mtime_sec < image_st->st_mtim.tv_sec || (key->mtime_sec == image_st->st_mtim.tv_sec
+			&& key->mtime_nsec < image_st->st_mtim.tv_nsec))) {
+		return 1;
+	}
+	return key_hash(key) == 0 && h->src_hash == key->hash ? 2 : 0;
+}
+
+/**
+ * Checks that a mapped image is well formed and belongs to the makefile
+ * at the path of key.
+ *
+ * @param h		Header of the mapped image.
+ * @param key	Key of the makefile.
+ * @param size	Size of the mapping.
+ * @return		1 if the image can be used, otherwise 0
+ */
+static int valid_header(const struct image_header *h, const cache_key *key, size_t size) {
+	const char *base = (const char *)h;
+
+	if(memcmp(h->magic, IMAGE_MAGIC, sizeof h->magic) != 0 || h->version != IMAGE_VERSION
+			|| h->ptr_size != sizeof(char *) || h->image_size != size) {
+		return 0;
+	}
+
+	// The string area must end with a terminator, and the layout must fit
+	uint64_t slots_base = sizeof *h + h->n_rules * sizeof(struct image_rule);
+	uint64_t capacity = h->index_capacity;
+	if(h->n_rules > size / sizeof(struct image_rule) || h->n_slots > size / sizeof(uint64_t)
+			|| capacity > size / sizeof(struct image_index_entry)
+			|| capacity == 0 || (capacity & (capacity - 1)) != 0 || h->index_count >= capacity
+			|| h->index != slots_base + h->n_slots * sizeof(uint64_t)
+			|| h->strings != h->index + capacity * sizeof(struct image_index_entry)
+			|| h->strings >= size || base[size - 1] != '\0') {
+		return 0;
+	}
+	if(h->path < h->strings || h->path >= size || strcmp(base + h->path, key->path) != 0) {
+		return 0;
+	}
+
+	const struct image_rule *rules = (const struct image_rule *)(base + sizeof *h);
+	for(uint64_t i = 0; i < h->n_rules; i++) {
+		if(rules[i].target < h->strings || rules[i].target >= size
+				|| rules[i].prereq < slots_base || rules[i].prereq >= h->strings
+				|| rules[i].cmd < slots_base || rules[i].cmd >= h->strings
+				|| (rules[i].prereq - slots_base) % sizeof(uint64_t) != 0
+				|| (rules[i].cmd - slots_base) % sizeof(uint64_t) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Rewrites every slot of a mapped image from an offset into a pointer.
+ *
+ * @param base	Start of the mapped image.
+ * @param h		Header of the image.
+ * @return		0 on success, 1 if a slot is out of range.
+ */
+static int relocate(char *base, const struct image_header *h) {
+	char *slot = base + sizeof *h + h->n_rules * sizeof(struct image_rule);
+	uint64_t offset = 0;
+
+	for(uint64_t i = 0; i < h->n_slots; i++, slot += sizeof offset) {
+		memcpy(&offset, slot, sizeof offset);
+		if(offset != 0 && (offset < h->strings || offset >= h->image_size)) {
+			return 1;
+		}
+		char *ptr = offset != 0 ? base + offset : NULL;
+		memcpy(slot, &ptr, sizeof ptr);
+	}
+
+	// Every array must be terminated inside the slot area
+	if(offset != 0) {
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Rewrites the index of a mapped image in place into a strmap table, and
+ * wraps it in a map from targets to the rules of a makefile.
+ *
+ * @param base		Start of the mapped image.
+ * @param h			Header of the image.
+ * @param mmakefile	The makefile holding the rules of the image.
+ * @return			The map, or NULL if the index is malformed or memory
+ *					ran out.
+ */
+static strmap *load_index(char *base, const struct image_header *h, makefile *mmakefile) {
+	rule **rules = malloc((h->n_rules + 1) * sizeof *rules);
+	if(rules == NULL) {
+		return NULL;
+	}
+	size_t n_rules = 0;
+	for(rule *r = makefile_first_rule(mmakefile); r != NULL; r = rule_next(r)) {
+		rules[n_rules++] = r;
+	}
+
+	// Entries shrink or keep their size, so each is written over its own
+	char *entries = base + h->index;
+	uint64_t count = 0;
+	for(uint64_t i = 0; i < h->index_capacity; i++) {
+		struct image_index_entry ie;
+		memcpy(&ie, entries + i * sizeof ie, sizeof ie);
+		strmap_entry e = {0};
+		if(ie.target != 0) {
+			if(ie.target < h->strings || ie.target >= h->image_size || ie.rule >= n_rules) {
+				free(rules);
+				return NULL;
+			}
+			e.key = base + ie.target;
+			e.value = rules[ie.rule];
+			e.hash = ie.hash;
+			count++;
+		}
+		memcpy(entries + i * sizeof e, &e, sizeof e);
+	}
+	free(rules);
+
+	if(count != h->index_count) {
+		return NULL;
+	}
+	return strmap_wrap((strmap_entry *)entries, h->index_capacity, count);
+}
+
+/**
+ * Appends bytes to a growable buffer.
+ *
+ * @param buf	The buffer.
+ * @param data	The bytes to append.
+ * @param len	Number of bytes.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int buf_append(struct buffer *buf, const void *data, size_t len) {
+	if(buf->len + len > buf->cap) {
+		size_t cap = buf->cap != 0 ? buf->cap : 4096;
+		while(cap < buf->len + len) {
+			cap *= 2;
+		}
+		char *data_new = realloc(buf->data, cap);
+		if(data_new == NULL) {
+			return 1;
+		}
+		buf->data = data_new;
+		buf->cap = cap;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+/**
+ * Stores a string in the string area, reusing an earlier copy if the same
+ * string has already been stored.
+ *
+ * @param strings	The string area.
+ * @param seen		Map from already stored strings to their offset.
+ * @param base		Offset of the string area in the image.
+ * @param str		The string to store.
+ * @param offset	Filled with the offset of the string in the image.
+ * @return			0 on success, 1 if out of memory.
+ */
+static int intern(struct buffer *strings, strmap *seen, uint64_t base, const char *str, uint64_t *offset) {
+	uintptr_t known = (uintptr_t)strmap_get(seen, str);
+	if(known != 0) {
+		*offset = known;
+		return 0;
+	}
+
+	*offset = base + strings->len;
+	if(buf_append(strings, str, strlen(str) + 1) == 1
+			|| strmap_put(seen, str, (void *)(uintptr_t)*offset) == 1) {
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Stores a NULL-terminated string array as a run of slots.
+ *
+ * @param slots		The slot area.
+ * @param strings	The string area.
+ * @param seen		Map from already stored strings to their offset.
+ * @param base		Offset of the string area in the image.
+ * @param arr		The array to store.
+ * @return			0 on success, 1 if out of memory.
+ */
+static int put_array(struct buffer *slots, struct buffer *strings, strmap *seen, uint64_t base, char **arr) {
+	uint64_t offset;
+	for(size_t i = 0; arr[i] != NULL; i++) {
+		if(intern(strings, seen, base, arr[i], &offset) == 1
+				|| buf_append(slots, &offset, sizeof offset) == 1) {
+			return 1;
+		}
+	}
+	offset = 0;
+	return buf_append(slots, &offset, sizeof offset);
+}
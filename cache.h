@@ -0,0 +1,78 @@
+/**
+ * cache.h - Pre-compiled binary images of parsed makefiles.
+ *
+ * After a makefile has been parsed, its rules can be written to a compact
+ * binary image next to it. Later runs map the image into memory and use
+ * the strings and arrays in it directly, skipping the text parser. An
+ * image is only used if the path and size of the makefile match the ones
+ * recorded in it, and either its modification time does too or, failing
+ * that, the hash of its contents.
+ *
+ * Functions:
+ *  - cache_key_init(): Computes the key identifying a makefile's contents.
+ *  - cache_load(): Loads the image matching a key, if there is one.
+ *  - cache_store(): Writes the image of a parsed makefile.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-21
+ * @Version:	1.0
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "parser.h"
+
+/* Suffix appended to the makefile path to name its image. */
+#define CACHE_SUFFIX ".mmc"
+
+/*
+ * Identifies the contents of a makefile. The hash of the contents is only
+ * computed when needed, from fp, and then kept.
+ */
+typedef struct cache_key {
+	const char *path;
+	FILE *fp;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t hash;
+	int hashed;
+} cache_key;
+
+/**
+ * Computes the key identifying the current contents of a makefile from
+ * its size and modification time. The file is not read; if its contents
+ * have to be hashed later, it is read from the start and rewound, so it
+ * can still be parsed.
+ *
+ * @param key	The key to fill in.
+ * @param path	Path of the makefile. It is not copied.
+ * @param fp	The opened makefile. It must stay open while key is used.
+ * @return		0 on success, 1 if the file could not be examined.
+ */
+int cache_key_init(cache_key *key, const char *path, FILE *fp);
+
+/**
+ * Loads the image matching a key. The caller of this function is
+ * responsible for deallocating the makefile by using makefile_del.
+ *
+ * @param key	Key of the makefile to load.
+ * @return		The makefile, or NULL if there is no valid image for the key.
+ */
+makefile *cache_load(cache_key *key);
+
+/**
+ * Writes the image of a parsed makefile. The image is written to a
+ * temporary file and renamed into place, so concurrent runs never see a
+ * partially written image.
+ *
+ * @param key		Key of the makefile.
+ * @param mmakefile	The parsed makefile.
+ * @return			0 on success, 1 if the image could not be written.
+ */
+int cache_store(cache_key *key, makefile *mmakefile);
+
+#endif
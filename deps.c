@@ -0,0 +1,553 @@
+/**
+ * deps.c - Dependencies discovered from compiler depfiles.
+ *
+ * The deps log starts with a magic header followed by records, appended
+ * as targets are built:
+ *
+ *      n_deps (u32) | data_len (u32) | target \0 dep \0 dep \0 ...
+ *
+ * The log is read with a single read at startup. When a target appears in
+ * several records the last one wins. A record cut short by a crash is
+ * ignored and truncated away before the next append. When superseded
+ * records make up most of the log it is rewritten on close.
+ *
+ * Functions:
+ *  - deps_log_open(): Loads the deps log and the .DEPFILE annotations.
+ *  - deps_log_get(): Returns the discovered prerequisites of a target.
+ *  - deps_log_update(): Records the depfile of a freshly built target.
+ *  - deps_log_set(): Records given prerequisites for a target.
+ *  - deps_log_close(): Compacts the log if needed and frees it.
+ *  - load_log(): Reads all records of an existing log.
+ *  - make_entry(): Allocates an entry holding a target and its deps.
+ *  - put_entry(): Stores an entry, replacing any older one for the target.
+ *  - append_record(): Appends an entry to the log file.
+ *  - encode_record(): Encodes an entry in the on-disk format.
+ *  - compact(): Rewrites the log with one record per target.
+ *  - record_deps(): Replaces the prerequisites of a target and logs them.
+ *  - depfile_path(): Derives the depfile path of a target.
+ *  - parse_depfile(): Reads the prerequisites from a depfile.
+ *  - read_file(): Reads a whole file into memory.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-25
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "deps.h"
+#include "strmap.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define LOG_MAGIC "MMKDEPS1"
+#define MAGIC_LEN 8
+#define COMPACT_MIN_RECORDS 100
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct deps_entry {
+	size_t slot;
+	const char *target;
+	const char *deps[];
+};
+
+struct deps_log {
+	char *path;
+	strmap *entries;
+	strmap *declared;
+	struct deps_entry **list;
+	size_t n_entries;
+	size_t cap;
+	size_t n_records;
+	size_t valid_end;
+	int fd;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void load_log(deps_log *log);
+static struct deps_entry *make_entry(const char *target, char **deps, size_t n_deps);
+static int put_entry(deps_log *log, struct deps_entry *entry);
+static int append_record(deps_log *log, const struct deps_entry *entry);
+static char *encode_record(const struct deps_entry *entry, size_t *len);
+static void compact(deps_log *log);
+static int record_deps(deps_log *log, const char *target, char **deps, size_t n_deps);
+static char *depfile_path(const char *target);
+static char **parse_depfile(const char *path, size_t *n_deps);
+static char *read_file(const char *path, size_t *len);
+
+/* -------------------------- External functions -------------------------- */
+
+deps_log *deps_log_open(const char *path, makefile *mmakefile) {
+	deps_log *log = calloc(1, sizeof *log);
+	if(log == NULL) {
+		return NULL;
+	}
+	log->fd = -1;
+	log->path = strdup(path);
+	log->entries = strmap_new();
+	log->declared = strmap_new();
+	if(log->path == NULL || log->entries == NULL || log->declared == NULL) {
+		deps_log_close(log);
+		return NULL;
+	}
+
+	// A rule holds only so many prerequisites, so .DEPFILE may be repeated
+	for(rule *r = makefile_first_rule(mmakefile); r != NULL; r = rule_next(r)) {
+		if(strcmp(rule_target(r), DEPFILE_TARGET) != 0) {
+			continue;
+		}
+		const char **prereq = rule_prereq(r);
+		for(int index = 0; prereq[index] != NULL; index++) {
+			if(strmap_put(log->declared, prereq[index], log) == 1) {
+				deps_log_close(log);
+				return NULL;
+			}
+		}
+	}
+
+	load_log(log);
+	return log;
+}
+
+const char **deps_log_get(deps_log *log, const char *target) {
+	struct deps_entry *entry = strmap_get(log->entries, target);
+	return entry != NULL ? entry->deps : NULL;
+}
+
+int deps_log_update(deps_log *log, const char *target) {
+	size_t n_deps;
+	if(strmap_get(log->declared, target) == NULL) {
+		return 0;
+	}
+
+	char *path = depfile_path(target);
+	if(path == NULL) {
+		return 1;
+	}
+	char **deps = parse_depfile(path, &n_deps);
+	free(path);
+	if(deps == NULL) {
+		return 1;
+	}
+
+	int failed = record_deps(log, target, deps, n_deps);
+	for(size_t i = 0; i < n_deps; i++) {
+		free(deps[i]);
+	}
+	free(deps);
+	return failed ? 2 : 0;
+}
+
+int deps_log_set(deps_log *log, const char *target, const char **deps) {
+	size_t n_deps = 0;
+	if(strmap_get(log->declared, target) == NULL) {
+		return 0;
+	}
+	while(deps[n_deps] != NULL) {
+		n_deps++;
+	}
+	return record_deps(log, target, (char **)deps, n_deps);
+}
+
+void deps_log_close(deps_log *log) {
+	if(log == NULL) {
+		return;
+	}
+	if(log->fd != -1) {
+		close(log->fd);
+	}
+	if(log->n_records > COMPACT_MIN_RECORDS && log->n_records > 2 * log->n_entries) {
+		compact(log);
+	}
+	for(size_t i = 0; i < log->n_entries; i++) {
+		free(log->list[i]);
+	}
+	free(log->list);
+	strmap_del(log->entries);
+	strmap_del(log->declared);
+	free(log->path);
+	free(log);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Reads all records of an existing log. Reading stops at the first record
+ * that is incomplete or malformed.
+ *
+ * @param log	The deps log.
+ */
+static void load_log(deps_log *log) {
+	size_t len;
+	char *data = read_file(log->path, &len);
+	if(data == NULL) {
+		return;
+	}
+	if(len < MAGIC_LEN || memcmp(data, LOG_MAGIC, MAGIC_LEN) != 0) {
+		free(data);
+		return;
+	}
+
+	size_t pos = MAGIC_LEN;
+	log->valid_end = pos;
+	while(len - pos >= 2 * sizeof(uint32_t)) {
+		uint32_t n_deps;
+		uint32_t data_len;
+		memcpy(&n_deps, data + pos, sizeof n_deps);
+		memcpy(&data_len, data + pos + sizeof n_deps, sizeof data_len);
+		pos += 2 * sizeof(uint32_t);
+		if(data_len > len - pos || data_len == 0 || data[pos + data_len - 1] != '\0') {
+			break;
+		}
+
+		// Split the data into the target and its deps
+		char **strs = n_deps < data_len ? malloc(((size_t)n_deps + 1) * sizeof *strs) : NULL;
+		if(strs == NULL) {
+			break;
+		}
+		size_t n = 0;
+		for(char *p = data + pos; p < data + pos + data_len && n <= n_deps; p += strlen(p) + 1) {
+			strs[n++] = p;
+		}
+
+		struct deps_entry *entry = NULL;
+		if(n == (size_t)n_deps + 1) {
+			entry = make_entry(strs[0], strs + 1, n_deps);
+		}
+		free(strs);
+		if(entry == NULL || put_entry(log, entry) == 1) {
+			free(entry);
+			break;
+		}
+		pos += data_len;
+		log->valid_end = pos;
+		log->n_records++;
+	}
+	free(data);
+}
+
+/**
+ * Allocates an entry holding copies of a target and its deps, in a single
+ * block of memory.
+ *
+ * @param target	The target.
+ * @param deps		The deps of the target.
+ * @param n_deps	Number of deps.
+ * @return			The entry, or NULL if out of memory.
+ */
+static struct deps_entry *make_entry(const char *target, char **deps, size_t n_deps) {
+	size_t size = sizeof(struct deps_entry) + (n_deps + 1) * sizeof(char *) + strlen(target) + 1;
+	for(size_t i = 0; i < n_deps; i++) {
+		size += strlen(deps[i]) + 1;
+	}
+
+	struct deps_entry *entry = malloc(size);
+	if(entry == NULL) {
+		return NULL;
+	}
+	char *p = (char *)&entry->deps[n_deps + 1];
+	entry->target = p;
+	p = stpcpy(p, target) + 1;
+	for(size_t i = 0; i < n_deps; i++) {
+		entry->deps[i] = p;
+		p = stpcpy(p, deps[i]) + 1;
+	}
+	entry->deps[n_deps] = NULL;
+	return entry;
+}
+
+/**
+ * Stores an entry, replacing and freeing any older entry for its target.
+ *
+ * @param log	The deps log.
+ * @param entry	The entry, owned by the log on success.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int put_entry(deps_log *log, struct deps_entry *entry) {
+	struct deps_entry *old = strmap_get(log->entries, entry->target);
+	if(old == NULL && log->n_entries == log->cap) {
+		size_t cap = log->cap != 0 ? log->cap * 2 : 64;
+		struct deps_entry **list = realloc(log->list, cap * sizeof *list);
+		if(list == NULL) {
+			return 1;
+		}
+		log->list = list;
+		log->cap = cap;
+	}
+	if(strmap_put(log->entries, entry->target, entry) == 1) {
+		return 1;
+	}
+
+	if(old != NULL) {
+		entry->slot = old->slot;
+		free(old);
+	} else {
+		entry->slot = log->n_entries++;
+	}
+	log->list[entry->slot] = entry;
+	return 0;
+}
+
+/**
+ * Appends an entry to the log file, creating the file if needed.
+ *
+ * @param log	The deps log.
+ * @param entry	The entry to append.
+ * @return		0 on success, 1 if the log could not be written, with errno
+ *				set.
+ */
+static int append_record(deps_log *log, const struct deps_entry *entry) {
+	size_t len;
+	if(log->fd == -1) {
+		log->fd = open(log->path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if(log->fd == -1) {
+			return 1;
+		}
+
+		// Start a new log, or cut off a record left incomplete by a crash
+		if(log->valid_end == 0 && (ftruncate(log->fd, 0) == -1
+				|| write(log->fd, LOG_MAGIC, MAGIC_LEN) != MAGIC_LEN)) {
+			return 1;
+		}
+		if(log->valid_end == 0) {
+			log->valid_end = MAGIC_LEN;
+		}
+		if(ftruncate(log->fd, log->valid_end) == -1 || lseek(log->fd, 0, SEEK_END) == -1) {
+			return 1;
+		}
+	}
+
+	char *record = encode_record(entry, &len);
+	if(record == NULL) {
+		return 1;
+	}
+	ssize_t written = write(log->fd, record, len);
+	free(record);
+	if(written != (ssize_t)len) {
+		return 1;
+	}
+	log->valid_end += len;
+	log->n_records++;
+	return 0;
+}
+
+/**
+ * Encodes an entry in the on-disk record format. The returned buffer
+ * should be freed using free.
+ *
+ * @param entry	The entry.
+ * @param len	Filled with the length of the record.
+ * @return		The record, or NULL if out of memory.
+ */
+static char *encode_record(const struct deps_entry *entry, size_t *len) {
+	uint32_t n_deps = 0;
+	uint32_t data_len = strlen(entry->target) + 1;
+	while(entry->deps[n_deps] != NULL) {
+		data_len += strlen(entry->deps[n_deps]) + 1;
+		n_deps++;
+	}
+
+	*len = 2 * sizeof(uint32_t) + data_len;
+	char *record = malloc(*len);
+	if(record == NULL) {
+		return NULL;
+	}
+	memcpy(record, &n_deps, sizeof n_deps);
+	memcpy(record + sizeof n_deps, &data_len, sizeof data_len);
+	char *p = stpcpy(record + 2 * sizeof(uint32_t), entry->target) + 1;
+	for(uint32_t i = 0; i < n_deps; i++) {
+		p = stpcpy(p, entry->deps[i]) + 1;
+	}
+	return record;
+}
+
+/**
+ * Rewrites the log with one record per target, through a temporary file
+ * that is renamed into place. The old log is kept if anything fails.
+ *
+ * @param log	The deps log.
+ */
+static void compact(deps_log *log) {
+	char tmp_path[strlen(log->path) + 8];
+	snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", log->path);
+	int fd = mkstemp(tmp_path);
+	if(fd == -1) {
+		return;
+	}
+
+	int failed = write(fd, LOG_MAGIC, MAGIC_LEN) != MAGIC_LEN;
+	for(size_t i = 0; i < log->n_entries && !failed; i++) {
+		size_t len;
+		char *record = encode_record(log->list[i], &len);
+		failed = record == NULL || write(fd, record, len) != (ssize_t)len;
+		free(record);
+	}
+	if(close(fd) == -1 || failed || rename(tmp_path, log->path) == -1) {
+		unlink(tmp_path);
+	}
+}
+
+/**
+ * Replaces the discovered prerequisites of a target and appends them to
+ * the log.
+ *
+ * @param log		The deps log.
+ * @param target	The target.
+ * @param deps		The prerequisites.
+ * @param n_deps	Number of prerequisites.
+ * @return			0 on success, 1 if out of memory or the log could not be
+ *					written, with errno set.
+ */
+static int record_deps(deps_log *log, const char *target, char **deps, size_t n_deps) {
+	struct deps_entry *entry = make_entry(target, deps, n_deps);
+	if(entry == NULL || put_entry(log, entry) == 1) {
+		free(entry);
+		return 1;
+	}
+	return append_record(log, entry);
+}
+
+/**
+ * Derives the depfile path of a target by replacing its extension with
+ * ".d", the name gcc -MD uses. The returned string should be freed using
+ * free.
+ *
+ * @param target	The target.
+ * @return			The depfile path, or NULL if out of memory.
+ */
+static char *depfile_path(const char *target) {
+	size_t len = strlen(target);
+	const char *dot = strrchr(target, '.');
+	const char *slash = strrchr(target, '/');
+	if(dot != NULL && (slash == NULL || dot > slash)) {
+		len = dot - target;
+	}
+
+	char *path = malloc(len + 3);
+	if(path != NULL) {
+		memcpy(path, target, len);
+		strcpy(path + len, ".d");
+	}
+	return path;
+}
+
+/**
+ * Reads the prerequisites of the first rule in a depfile. Backslash-newline
+ * continues a line, "\ " and "\#" escape a space and a hash, and "$$"
+ * stands for "$". A depfile whose first rule is not ended by a newline was
+ * cut short, and its last name may be incomplete, so it is an error. The
+ * returned array and its strings should be freed using free.
+ *
+ * @param path		Path of the depfile.
+ * @param n_deps	Filled with the number of prerequisites.
+ * @return			Array of prerequisites, or NULL on error.
+ */
+static char **parse_depfile(const char *path, size_t *n_deps) {
+	size_t len;
+	char *data = read_file(path, &len);
+	if(data == NULL) {
+		return NULL;
+	}
+
+	// Every dependency is at least two bytes long, including its separator
+	char **deps = malloc((len / 2 + 1) * sizeof *deps);
+	char *word = malloc(len + 1);
+	if(deps == NULL || word == NULL) {
+		free(deps);
+		free(word);
+		free(data);
+		return NULL;
+	}
+
+	*n_deps = 0;
+	int after_colon = 0;
+	int ended = 0;
+	size_t i = 0;
+	while(i < len) {
+		// Skip blanks and line continuations; a real newline ends the rule
+		if(data[i] == ' ' || data[i] == '\t' || data[i] == '\r') {
+			i++;
+			continue;
+		}
+		if(data[i] == '\\' && i + 1 < len && data[i + 1] == '\n') {
+			i += 2;
+			continue;
+		}
+		if(data[i] == '\n') {
+			if(after_colon) {
+				ended = 1;
+				break;
+			}
+			i++;
+			continue;
+		}
+
+		size_t n = 0;
+		while(i < len && data[i] != ' ' && data[i] != '\t' && data[i] != '\n' && data[i] != '\r') {
+			if(data[i] == '\\' && i + 1 < len && (data[i + 1] == ' ' || data[i + 1] == '#')) {
+				i++;
+			} else if(data[i] == '\\' && i + 1 < len && data[i + 1] == '\n') {
+				break;
+			} else if(data[i] == '$' && i + 1 < len && data[i + 1] == '$') {
+				i++;
+			}
+			word[n++] = data[i++];
+		}
+		word[n] = '\0';
+
+		if(!after_colon) {
+			after_colon = n > 0 && word[n - 1] == ':';
+		} else if(n > 0 && (deps[*n_deps] = strdup(word)) != NULL) {
+			(*n_deps)++;
+		}
+	}
+
+	free(word);
+	free(data);
+	if(!ended) {
+		for(size_t index = 0; index < *n_deps; index++) {
+			free(deps[index]);
+		}
+		free(deps);
+		return NULL;
+	}
+	return deps;
+}
+
+/**
+ * Reads a whole file into memory. The returned buffer should be freed
+ * using free.
+ *
+ * @param path	Path of the file.
+ * @param len	Filled with the length of the file.
+ * @return		The contents, or NULL if the file could not be read.
+ */
+static char *read_file(const char *path, size_t *len) {
+	FILE *fp = fopen(path, "rb");
+	if(fp == NULL) {
+		return NULL;
+	}
+	if(fseek(fp, 0, SEEK_END) == -1) {
+		fclose(fp);
+		return NULL;
+	}
+	long size = ftell(fp);
+	rewind(fp);
+
+	char *data = size >= 0 ? malloc(size + 1) : NULL;
+	if(data == NULL || fread(data, 1, size, fp) != (size_t)size) {
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	data[size] = '\0';
+	*len = size;
+	return data;
+}
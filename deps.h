@@ -0,0 +1,94 @@
+/**
+ * deps.h - Dependencies discovered from compiler depfiles.
+ *
+ * Rules may declare that their command writes a gcc-style depfile (as
+ * produced by -MD) by listing their targets under the special target
+ * .DEPFILE, which may be given more than once:
+ *
+ *      .DEPFILE: mmake.o parser.o
+ *
+ * The depfile of a target is the target with its extension replaced by
+ * ".d". After such a target has been rebuilt its depfile is parsed and the
+ * prerequisites found in it are recorded in a binary deps log. The log is
+ * loaded at startup, so later builds also rebuild the target when one of
+ * those discovered files (typically headers) changes.
+ *
+ * Functions:
+ *  - deps_log_open(): Loads the deps log and the .DEPFILE annotations.
+ *  - deps_log_get(): Returns the discovered prerequisites of a target.
+ *  - deps_log_update(): Records the depfile of a freshly built target.
+ *  - deps_log_set(): Records given prerequisites for a target.
+ *  - deps_log_close(): Compacts the log if needed and frees it.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-25
+ * @Version:	1.0
+ */
+
+#ifndef DEPS_H
+#define DEPS_H
+
+#include "parser.h"
+
+/* Name of the special target listing targets that write depfiles. */
+#define DEPFILE_TARGET ".DEPFILE"
+
+/* Default path of the deps log. */
+#define DEPS_LOG ".mmake_deps"
+
+typedef struct deps_log deps_log;
+
+/**
+ * Loads the deps log and the .DEPFILE annotations of a makefile. The log
+ * file is only created once something is recorded in it. The caller is
+ * responsible for closing the log with deps_log_close.
+ *
+ * @param path		Path of the deps log.
+ * @param mmakefile	The parsed makefile.
+ * @return			The log, or NULL if out of memory.
+ */
+deps_log *deps_log_open(const char *path, makefile *mmakefile);
+
+/**
+ * Returns the prerequisites discovered for a target by its last build.
+ *
+ * @param log		The deps log.
+ * @param target	The target.
+ * @return			NULL-terminated array, or NULL if none are recorded.
+ */
+const char **deps_log_get(deps_log *log, const char *target);
+
+/**
+ * Parses the depfile of a freshly built target and records the
+ * prerequisites found in it. Does nothing for targets not listed under
+ * .DEPFILE. Nothing is printed; the caller reports any error.
+ *
+ * @param log		The deps log.
+ * @param target	The target that was built.
+ * @return			0 on success, 1 if the depfile could not be read, 2 if
+ *					the log could not be written, with errno set.
+ */
+int deps_log_update(deps_log *log, const char *target);
+
+/**
+ * Records the given prerequisites as discovered for a target, as if read
+ * from its depfile, such as those of a target restored from the artifact
+ * cache. Does nothing for targets not listed under .DEPFILE.
+ *
+ * @param log		The deps log.
+ * @param target	The target.
+ * @param deps		The prerequisites, terminated with NULL.
+ * @return			0 on success, 1 if the log could not be written, with
+ *					errno set.
+ */
+int deps_log_set(deps_log *log, const char *target, const char **deps);
+
+/**
+ * Rewrites the log without superseded records if it has grown too large,
+ * then frees it.
+ *
+ * @param log	The deps log, or NULL.
+ */
+void deps_log_close(deps_log *log);
+
+#endif
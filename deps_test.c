@@ -0,0 +1,276 @@
+/**
+ * deps_test.c - Tests of depfile parsing and the deps log.
+ *
+ * Each test writes a depfile for a target listed under .DEPFILE, records
+ * it with deps_log_update and compares the prerequisites found with the
+ * expected ones. The log tests check that a log cut off mid-record keeps
+ * its complete records, and that a log with many stale records is
+ * compacted to one record per target when it is closed. The tests run in
+ * a fresh temporary directory.
+ *
+ * Synopsis:
+ *      ./deps_test
+ *
+ * Functions:
+ *  - main(): Entry point of the tests.
+ *  - test_depfile(): Records a depfile and checks the prerequisites found.
+ *  - test_truncated_log(): Checks that a cut off log keeps complete records.
+ *  - test_compaction(): Checks that a log is compacted when closed.
+ *  - check(): Reports the outcome of a single check.
+ *  - same_deps(): Compares recorded prerequisites with expected ones.
+ *  - write_file(): Writes a string to a file.
+ *  - file_size(): Returns the size of a file.
+ *  - load_makefile(): Parses a makefile held in a string.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-25
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "deps.h"
+#include "parser.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define TEST_MAKEFILE "a.o: a.c\n\tgcc -MD -c a.c\n\nb.o: b.c\n\tgcc -MD -c b.c\n\n.DEPFILE: a.o b.o\n"
+#define TEST_LOG "deps.log"
+#define N_REWRITES 150
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int test_depfile(makefile *mmakefile, const char *name, const char *contents, const char **expected);
+static int test_truncated_log(makefile *mmakefile);
+static int test_compaction(makefile *mmakefile);
+static int check(const char *name, int passed);
+static int same_deps(const char **deps, const char **expected);
+static int write_file(const char *path, const char *contents);
+static long file_size(const char *path);
+static makefile *load_makefile(const char *text);
+
+/* -------------------------- External functions -------------------------- */
+
+/**
+ * Entry point of the tests.
+ *
+ * @return	0 if every test passed, otherwise 1
+ */
+int main(void) {
+	char dir[] = "/tmp/deps_test.XXXXXX";
+	if(mkdtemp(dir) == NULL || chdir(dir) == -1) {
+		perror(dir);
+		return EXIT_FAILURE;
+	}
+	makefile *mmakefile = load_makefile(TEST_MAKEFILE);
+	if(mmakefile == NULL) {
+		fprintf(stderr, "could not parse the test makefile\n");
+		return EXIT_FAILURE;
+	}
+
+	int failed = 0;
+	failed += test_depfile(mmakefile, "plain", "a.o: a.c a.h\n",
+		(const char *[]){"a.c", "a.h", NULL});
+	failed += test_depfile(mmakefile, "escaped space", "a.o: a.c my\\ header.h\n",
+		(const char *[]){"a.c", "my header.h", NULL});
+	failed += test_depfile(mmakefile, "escaped hash and dollar", "a.o: a\\#1.h a$$2.h\n",
+		(const char *[]){"a#1.h", "a$2.h", NULL});
+	failed += test_depfile(mmakefile, "continuation", "a.o: a.c \\\n  a.h \\\n  b.h\n",
+		(const char *[]){"a.c", "a.h", "b.h", NULL});
+	failed += test_depfile(mmakefile, "continuation without blank", "a.o: a.c\\\n a.h\n",
+		(const char *[]){"a.c", "a.h", NULL});
+	failed += test_depfile(mmakefile, "multiple targets", "a.o a.d: a.c a.h\n",
+		(const char *[]){"a.c", "a.h", NULL});
+	failed += test_depfile(mmakefile, "phony header rules", "a.o: a.c a.h\n\na.h:\n",
+		(const char *[]){"a.c", "a.h", NULL});
+	failed += test_depfile(mmakefile, "truncated name", "a.o: a.c a.",
+		NULL);
+	failed += test_depfile(mmakefile, "truncated continuation", "a.o: a.c \\",
+		NULL);
+	failed += test_depfile(mmakefile, "truncated before colon", "a.o",
+		NULL);
+	failed += test_truncated_log(mmakefile);
+	failed += test_compaction(mmakefile);
+
+	makefile_del(mmakefile);
+	unlink("a.d");
+	unlink(TEST_LOG);
+	rmdir(dir);
+	printf("%s\n", failed == 0 ? "all tests passed" : "some tests failed");
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Writes the depfile of a.o, records it in a fresh log and checks the
+ * prerequisites found. A depfile that should be rejected must leave the
+ * prerequisites recorded before it in place.
+ *
+ * @param mmakefile	The test makefile.
+ * @param name		Name of the test.
+ * @param contents	Contents of the depfile.
+ * @param expected	The expected prerequisites, terminated with NULL, or
+ *					NULL if the depfile should be rejected.
+ * @return			0 if the test passed, otherwise 1
+ */
+static int test_depfile(makefile *mmakefile, const char *name, const char *contents, const char **expected) {
+	unlink(TEST_LOG);
+	deps_log *log = deps_log_open(TEST_LOG, mmakefile);
+	if(log == NULL || deps_log_set(log, "a.o", (const char *[]){"old.h", NULL}) != 0
+			|| write_file("a.d", contents) == 1) {
+		deps_log_close(log);
+		return check(name, 0);
+	}
+
+	int passed;
+	if(expected == NULL) {
+		passed = deps_log_update(log, "a.o") == 1
+			&& same_deps(deps_log_get(log, "a.o"), (const char *[]){"old.h", NULL});
+	} else {
+		passed = deps_log_update(log, "a.o") == 0 && same_deps(deps_log_get(log, "a.o"), expected);
+	}
+	deps_log_close(log);
+	return check(name, passed);
+}
+
+/**
+ * Records two targets, cuts the last byte off the log as a crash in the
+ * middle of a write would, and checks that the first record survives a
+ * reload, and that a record appended afterwards can be read back.
+ *
+ * @param mmakefile	The test makefile.
+ * @return			0 if the test passed, otherwise 1
+ */
+static int test_truncated_log(makefile *mmakefile) {
+	unlink(TEST_LOG);
+	deps_log *log = deps_log_open(TEST_LOG, mmakefile);
+	if(log == NULL || deps_log_set(log, "a.o", (const char *[]){"a.h", NULL}) != 0
+			|| deps_log_set(log, "b.o", (const char *[]){"b.h", NULL}) != 0) {
+		deps_log_close(log);
+		return check("truncated log", 0);
+	}
+	deps_log_close(log);
+	if(truncate(TEST_LOG, file_size(TEST_LOG) - 1) == -1 || (log = deps_log_open(TEST_LOG, mmakefile)) == NULL) {
+		return check("truncated log", 0);
+	}
+
+	int passed = same_deps(deps_log_get(log, "a.o"), (const char *[]){"a.h", NULL})
+		&& deps_log_get(log, "b.o") == NULL
+		&& deps_log_set(log, "b.o", (const char *[]){"c.h", NULL}) == 0;
+	deps_log_close(log);
+	if(passed && (log = deps_log_open(TEST_LOG, mmakefile)) != NULL) {
+		passed = same_deps(deps_log_get(log, "a.o"), (const char *[]){"a.h", NULL})
+			&& same_deps(deps_log_get(log, "b.o"), (const char *[]){"c.h", NULL});
+		deps_log_close(log);
+	}
+	return check("truncated log", passed);
+}
+
+/**
+ * Rewrites the prerequisites of one target many times, so that the log
+ * holds far more records than targets, and checks that closing it leaves
+ * a single record holding the latest prerequisites.
+ *
+ * @param mmakefile	The test makefile.
+ * @return			0 if the test passed, otherwise 1
+ */
+static int test_compaction(makefile *mmakefile) {
+	unlink(TEST_LOG);
+	deps_log *log = deps_log_open(TEST_LOG, mmakefile);
+	if(log == NULL) {
+		return check("compaction", 0);
+	}
+	int passed = 1;
+	for(int i = 0; i < N_REWRITES && passed; i++) {
+		passed = deps_log_set(log, "a.o", (const char *[]){i % 2 == 0 ? "even.h" : "odd.h", NULL}) == 0;
+	}
+	long before = file_size(TEST_LOG);
+	deps_log_close(log);
+
+	// Only the record holding the latest prerequisites is kept
+	passed = passed && file_size(TEST_LOG) < before / (N_REWRITES / 2);
+	if(passed && (log = deps_log_open(TEST_LOG, mmakefile)) != NULL) {
+		passed = same_deps(deps_log_get(log, "a.o"), (const char *[]){"odd.h", NULL});
+		deps_log_close(log);
+	}
+	return check("compaction", passed);
+}
+
+/**
+ * Reports the outcome of a single check.
+ *
+ * @param name		Name of the check.
+ * @param passed	Non-zero if the check passed.
+ * @return			0 if the check passed, otherwise 1
+ */
+static int check(const char *name, int passed) {
+	printf("%s: %s\n", passed ? "ok" : "FAIL", name);
+	return !passed;
+}
+
+/**
+ * Compares recorded prerequisites with expected ones.
+ *
+ * @param deps		The recorded prerequisites, or NULL.
+ * @param expected	The expected prerequisites, terminated with NULL.
+ * @return			1 if they are the same, otherwise 0
+ */
+static int same_deps(const char **deps, const char **expected) {
+	if(deps == NULL) {
+		return 0;
+	}
+	int index = 0;
+	for(; deps[index] != NULL && expected[index] != NULL; index++) {
+		if(strcmp(deps[index], expected[index]) != 0) {
+			return 0;
+		}
+	}
+	return deps[index] == NULL && expected[index] == NULL;
+}
+
+/**
+ * Writes a string to a file, replacing it.
+ *
+ * @param path		Path of the file.
+ * @param contents	The string to write.
+ * @return			0 on success, otherwise 1
+ */
+static int write_file(const char *path, const char *contents) {
+	FILE *fp = fopen(path, "w");
+	if(fp == NULL) {
+		return 1;
+	}
+	int failed = fputs(contents, fp) == EOF;
+	return fclose(fp) == EOF || failed;
+}
+
+/**
+ * Returns the size of a file.
+ *
+ * @param path	Path of the file.
+ * @return		The size in bytes, or -1 if the file could not be statted.
+ */
+static long file_size(const char *path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/**
+ * Parses a makefile held in a string.
+ *
+ * @param text	The makefile.
+ * @return		The parsed makefile, or NULL on error.
+ */
+static makefile *load_makefile(const char *text) {
+	FILE *fp = fmemopen((void *)text, strlen(text), "r");
+	if(fp == NULL) {
+		return NULL;
+	}
+	makefile *mmakefile = parse_makefile(fp);
+	fclose(fp);
+	return mmakefile;
+}
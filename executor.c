@@ -0,0 +1,1158 @@
+/**
+ * executor.c - Runs build commands on behalf of the build logic.
+ *
+ * Worker protocol: every message is a sequence of fields written to a
+ * stream socket. Integers are sent as 32-bit values in host byte order,
+ * strings as a length followed by the bytes, and string arrays as a count
+ * followed by the strings.
+ *
+ *      job:    argv[] cwd inputs[] outputs[] timeout     (cwd "" = current dir)
+ *      result: exit_code timed_out spawn_us log     (spawn_us -1 = unknown)
+ *
+ * A worker closes its socket and exits when mmake closes the other end.
+ *
+ * Jobs are submitted without waiting for them. A job for the worker pool
+ * goes to an idle worker, or waits in a queue shared by all workers until
+ * one finishes its job; results are collected in the order they come in.
+ * The local and custom executors run a job when it is submitted, so their
+ * results are ready at once.
+ *
+ * Timeouts are enforced by wait_job, which waits in a single poll on a
+ * pidfd of the child, the pipe its output is captured through (in a
+ * worker) and the next deadline; without pidfds it checks for the exit
+ * every EXIT_POLL_MS instead. Jobs without a timeout stay in mmake's
+ * process group, so a terminal's interrupt still reaches them directly.
+ * A job with a timeout is in a group of its own, so while it runs the
+ * signals in forwarded_signals are caught and sent on to its group before
+ * taking their usual effect, and a local job started from the foreground
+ * of a terminal is given the terminal, and so its interrupt, until it
+ * exits. Workers are sent SIGTERM if mmake dies, and pass it on the same
+ * way.
+ *
+ * Functions:
+ *  - executor_local(): Creates an executor that forks commands directly.
+ *  - executor_workers(): Creates an executor backed by worker processes.
+ *  - executor_custom(): Creates an executor that calls a caller's function.
+ *  - executor_submit(): Submits a job without waiting for it.
+ *  - executor_collect(): Waits for the result of a submitted job.
+ *  - executor_in_flight(): Counts the jobs submitted but not collected.
+ *  - executor_run(): Runs a job and waits for its result.
+ *  - executor_del(): Stops an executor and frees its memory.
+ *  - job_result_free(): Frees the memory held by a job result.
+ *  - run_local(): Forks and executes a job, waiting for it to finish.
+ *  - run_custom(): Hands a job to the caller's function.
+ *  - encode_job(): Encodes a job as a message to a worker.
+ *  - dispatch(): Sends pending jobs to a worker once it is idle.
+ *  - poll_workers(): Receives the results of the workers that are done.
+ *  - receive_result(): Reads the result of a worker's job.
+ *  - take_done(), push_entry(), free_entries(): Queues of jobs.
+ *  - reset_result(): Resets a result to that of a job that has not run.
+ *  - spawn_job(): Forks a child that executes a job.
+ *  - wait_job(): Waits for a job's child, enforcing its timeout.
+ *  - forward_signals(): Starts or stops forwarding signals to a job's group.
+ *  - forward_signal(): Signal handler passing a signal on to a job's group.
+ *  - set_foreground(): Makes a process group the terminal's foreground.
+ *  - ms_until(): Computes the milliseconds left until a deadline.
+ *  - us_since(): Computes the microseconds passed since a time.
+ *  - set_error(): Leaves the reason a job could not be run in its result.
+ *  - worker_loop(): Main loop of a worker process.
+ *  - exec_job(): Replaces the calling process with a job's command.
+ *  - buf_append(), put_u32(), put_str(), put_strs(): Message encoding.
+ *  - read_full(), get_u32(), get_str(), get_strs(): Message decoding.
+ *  - free_strs(): Frees a decoded string array.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-23
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "executor.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define READ_CHUNK 4096
+#define EXIT_EXEC_FAILED 127
+
+/* Seconds a timed-out job gets after SIGTERM before it is sent SIGKILL. */
+#define KILL_GRACE 5
+
+/* Milliseconds between checks for the exit of a job, without a pidfd. */
+#define EXIT_POLL_MS 50
+
+/* Signals passed on to the process group of a job with a timeout. */
+static const int forwarded_signals[] = { SIGHUP, SIGINT, SIGTERM };
+#define N_FORWARDED (sizeof forwarded_signals / sizeof *forwarded_signals)
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct buffer {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+/*
+ * A submitted job, from submission until its result is collected. While
+ * it waits for a worker it holds its encoded message; once it has run it
+ * holds its result.
+ */
+struct entry {
+	struct buffer msg;
+	void *tag;
+	job_result result;
+	int failed;
+	struct entry *next;
+};
+
+/* A worker process, and the job it is running if it is busy. */
+struct worker {
+	int sock;
+	pid_t pid;
+	struct entry *running;
+};
+
+struct executor {
+	int (*run)(executor *ex, const job *j, job_result *result);
+	int (*custom)(void *ctx, const job *j, job_result *result);
+	void *ctx;
+	int n_workers;
+	struct worker *workers;
+	struct entry *pending;
+	struct entry *pending_tail;
+	struct entry *done;
+	struct entry *done_tail;
+	size_t n_in_flight;
+};
+
+/* Process group signals are forwarded to, and the actions they replaced. */
+static volatile sig_atomic_t job_group;
+static struct sigaction saved_actions[N_FORWARDED];
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static int run_local(executor *ex, const job *j, job_result *result);
+static int run_custom(executor *ex, const job *j, job_result *result);
+static int encode_job(const job *j, struct buffer *msg);
+static void dispatch(executor *ex, struct worker *w);
+static int poll_workers(executor *ex);
+static void receive_result(struct worker *w);
+static struct entry *take_done(executor *ex);
+static void push_entry(struct entry **head, struct entry **tail, struct entry *e);
+static void free_entries(struct entry *e);
+static void reset_result(job_result *result);
+static pid_t spawn_job(const job *j, int out_fd, int foreground);
+static int wait_job(pid_t pid, int timeout, int log_fd, struct buffer *log, int *status);
+static void forward_signals(pid_t group);
+static void forward_signal(int sig);
+static void set_foreground(pid_t group);
+static int ms_until(const struct timespec *deadline);
+static long us_since(const struct timespec *start);
+static void set_error(job_result *result, const char *what);
+static void worker_loop(int sock);
+static void exec_job(const job *j);
+static int buf_append(struct buffer *buf, const void *data, size_t len);
+static int put_u32(struct buffer *buf, uint32_t value);
+static int put_str(struct buffer *buf, const char *str, size_t len);
+static int put_strs(struct buffer *buf, const char **strs);
+static int read_full(int fd, void *data, size_t len);
+static int get_u32(int fd, uint32_t *value);
+static char *get_str(int fd, size_t *len);
+static char **get_strs(int fd);
+static void free_strs(char **strs);
+
+/* -------------------------- External functions -------------------------- */
+
+executor *executor_local(void) {
+	executor *ex = calloc(1, sizeof *ex);
+	if(ex == NULL) {
+		return NULL;
+	}
+	ex->run = run_local;
+	return ex;
+}
+
+executor *executor_workers(int n_workers) {
+	executor *ex = calloc(1, sizeof *ex);
+	if(ex == NULL) {
+		return NULL;
+	}
+	ex->workers = calloc(n_workers, sizeof *ex->workers);
+	if(ex->workers == NULL) {
+		executor_del(ex);
+		return NULL;
+	}
+
+	// Buffered output would otherwise be written once more by every worker
+	fflush(stdout);
+	for(int i = 0; i < n_workers; i++) {
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+			int err = errno;
+			executor_del(ex);
+			errno = err;
+			return NULL;
+		}
+
+		pid_t parent = getpid();
+		pid_t pid = fork();
+		if(pid < 0) {
+			int err = errno;
+			close(fds[0]);
+			close(fds[1]);
+			executor_del(ex);
+			errno = err;
+			return NULL;
+		} else if(pid == 0) {
+			// Do not outlive mmake, or leave a job's group running
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			if(getppid() != parent) {
+				_exit(EXIT_FAILURE);
+			}
+			for(int k = 0; k < ex->n_workers; k++) {
+				close(ex->workers[k].sock);
+			}
+			close(fds[0]);
+			worker_loop(fds[1]);
+		}
+
+		close(fds[1]);
+		ex->workers[i].sock = fds[0];
+		ex->workers[i].pid = pid;
+		ex->n_workers++;
+	}
+	return ex;
+}
+
+executor *executor_custom(int (*run)(void *ctx, const job *j, job_result *result), void *ctx) {
+	executor *ex = calloc(1, sizeof *ex);
+	if(ex == NULL) {
+		return NULL;
+	}
+	ex->run = run_custom;
+	ex->custom = run;
+	ex->ctx = ctx;
+	return ex;
+}
+
+int executor_submit(executor *ex, const job *j, void *tag) {
+	struct entry *e = calloc(1, sizeof *e);
+	if(e == NULL) {
+		return 1;
+	}
+	e->tag = tag;
+	reset_result(&e->result);
+	ex->n_in_flight++;
+
+	// The local and custom executors run the job there and then
+	if(ex->run != NULL) {
+		e->failed = ex->run(ex, j, &e->result);
+		push_entry(&ex->done, &ex->done_tail, e);
+		return 0;
+	}
+
+	if(encode_job(j, &e->msg) == 1) {
+		free(e->msg.data);
+		free(e);
+		ex->n_in_flight--;
+		return 1;
+	}
+	push_entry(&ex->pending, &ex->pending_tail, e);
+	for(int i = 0; i < ex->n_workers && ex->pending != NULL; i++) {
+		dispatch(ex, &ex->workers[i]);
+	}
+	return 0;
+}
+
+int executor_collect(executor *ex, job_result *result, void **tag) {
+	struct entry *e;
+	while((e = take_done(ex)) == NULL) {
+		if(poll_workers(ex) == 1) {
+			reset_result(result);
+			set_error(result, "poll failed");
+			*tag = NULL;
+			return 1;
+		}
+	}
+
+	*result = e->result;
+	*tag = e->tag;
+	int failed = e->failed;
+	free(e);
+	ex->n_in_flight--;
+	return failed;
+}
+
+size_t executor_in_flight(executor *ex) {
+	return ex->n_in_flight;
+}
+
+int executor_run(executor *ex, const job *j, job_result *result) {
+	struct entry *others = NULL;
+	struct entry *others_tail = NULL;
+	struct entry *e;
+	int token;
+
+	if(executor_submit(ex, j, &token) == 1) {
+		reset_result(result);
+		set_error(result, "could not submit job");
+		return 1;
+	}
+
+	// Results of other jobs that come in meanwhile are kept for collecting
+	for(;;) {
+		while((e = take_done(ex)) == NULL) {
+			if(poll_workers(ex) == 1) {
+				reset_result(result);
+				set_error(result, "poll failed");
+				return 1;
+			}
+		}
+		if(e->tag == &token) {
+			break;
+		}
+		push_entry(&others, &others_tail, e);
+	}
+	if(others != NULL) {
+		others_tail->next = ex->done;
+		if(ex->done == NULL) {
+			ex->done_tail = others_tail;
+		}
+		ex->done = others;
+	}
+
+	*result = e->result;
+	int failed = e->failed;
+	free(e);
+	ex->n_in_flight--;
+	return failed;
+}
+
+void executor_del(executor *ex) {
+	if(ex == NULL) {
+		return;
+	}
+	for(int i = 0; i < ex->n_workers; i++) {
+		close(ex->workers[i].sock);
+	}
+	for(int i = 0; i < ex->n_workers; i++) {
+		waitpid(ex->workers[i].pid, NULL, 0);
+		free_entries(ex->workers[i].running);
+	}
+	free_entries(ex->pending);
+	free_entries(ex->done);
+	free(ex->workers);
+	free(ex);
+}
+
+void job_result_free(job_result *result) {
+	free(result->log);
+	free(result->error);
+	result->log = NULL;
+	result->log_len = 0;
+	result->error = NULL;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Forks and executes a job in the current process's environment, with
+ * output going straight to mmake's stdout and stderr.
+ *
+ * @param ex		The executor (unused).
+ * @param j			The job to run.
+ * @param result	Filled with the result of the job.
+ * @return			0 if the job was run, 1 if it could not be started.
+ */
+static int run_local(executor *ex, const job *j, job_result *result) {
+	int status;
+	struct timespec start;
+	(void)ex;
+
+	// A job in a group of its own takes over the terminal mmake holds
+	int foreground = j->timeout > 0 && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = spawn_job(j, -1, foreground);
+	if(pid < 0) {
+		set_error(result, "fork failed");
+		return 1;
+	}
+	result->spawn_us = us_since(&start);
+
+	result->timed_out = wait_job(pid, j->timeout, -1, NULL, &status);
+	if(foreground) {
+		set_foreground(getpgrp());
+	}
+	if(result->timed_out == -1) {
+		set_error(result, "waitpid failed");
+		return 1;
+	}
+
+	// The terminal's interrupt reached only the job; act on it as well
+	if(foreground && WIFSIGNALED(status) && (WTERMSIG(status) == SIGINT || WTERMSIG(status) == SIGQUIT)) {
+		raise(WTERMSIG(status));
+	}
+	result->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	return 0;
+}
+
+/**
+ * Hands a job to the function supplied to executor_custom.
+ *
+ * @param ex		The executor.
+ * @param j			The job to run.
+ * @param result	Filled with the result of the job.
+ * @return			0 if the job was run, 1 if it could not be started.
+ */
+static int run_custom(executor *ex, const job *j, job_result *result) {
+	return ex->custom(ex->ctx, j, result);
+}
+
+/**
+ * Encodes a job as a message to a worker.
+ *
+ * @param j		The job.
+ * @param msg	The buffer to encode the message into.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int encode_job(const job *j, struct buffer *msg) {
+	const char *no_strs[] = { NULL };
+	const char *cwd = j->cwd != NULL ? j->cwd : "";
+
+	if(put_strs(msg, (const char **)j->argv) == 1 || put_str(msg, cwd, strlen(cwd)) == 1
+			|| put_strs(msg, j->inputs != NULL ? j->inputs : no_strs) == 1
+			|| put_strs(msg, j->outputs != NULL ? j->outputs : no_strs) == 1
+			|| put_u32(msg, j->timeout) == 1) {
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Sends the first pending job to a worker, if the worker is idle. A job
+ * that cannot be sent is done at once, with the reason as its error, and
+ * the next one is tried, so the queue never waits on a dead worker.
+ *
+ * @param ex	The executor.
+ * @param w		The worker.
+ */
+static void dispatch(executor *ex, struct worker *w) {
+	while(w->running == NULL && ex->pending != NULL) {
+		struct entry *e = ex->pending;
+		if((ex->pending = e->next) == NULL) {
+			ex->pending_tail = NULL;
+		}
+		e->next = NULL;
+
+		size_t sent = 0;
+		while(sent < e->msg.len) {
+			ssize_t n = send(w->sock, e->msg.data + sent, e->msg.len - sent, MSG_NOSIGNAL);
+			if(n == -1 && errno == EINTR) {
+				continue;
+			} else if(n == -1) {
+				break;
+			}
+			sent += n;
+		}
+		if(sent < e->msg.len) {
+			set_error(&e->result, "worker unreachable");
+			e->failed = 1;
+			push_entry(&ex->done, &ex->done_tail, e);
+		} else {
+			w->running = e;
+		}
+		free(e->msg.data);
+		e->msg = (struct buffer){0};
+	}
+}
+
+/**
+ * Waits until at least one busy worker has sent back its result, receives
+ * every result that has come in and hands the freed workers their next
+ * pending job.
+ *
+ * @param ex	The executor, with at least one job in flight.
+ * @return		0 on success, 1 if polling failed or no worker is busy.
+ */
+static int poll_workers(executor *ex) {
+	struct pollfd fds[ex->n_workers > 0 ? ex->n_workers : 1];
+	int n_fds = 0;
+	for(int i = 0; i < ex->n_workers; i++) {
+		if(ex->workers[i].running != NULL) {
+			fds[n_fds++] = (struct pollfd){ .fd = ex->workers[i].sock, .events = POLLIN };
+		}
+	}
+	if(n_fds == 0) {
+		errno = 0;
+		return 1;
+	}
+
+	int ready;
+	while((ready = poll(fds, n_fds, -1)) == -1 && errno == EINTR) {
+		;
+	}
+	if(ready == -1) {
+		return 1;
+	}
+	for(int i = 0, k = 0; i < ex->n_workers; i++) {
+		struct worker *w = &ex->workers[i];
+		if(w->running == NULL || fds[k++].revents == 0) {
+			continue;
+		}
+		struct entry *e = w->running;
+		receive_result(w);
+		push_entry(&ex->done, &ex->done_tail, e);
+		w->running = NULL;
+		dispatch(ex, w);
+	}
+	return 0;
+}
+
+/**
+ * Reads the result of the job a worker is running into its entry.
+ *
+ * @param w	The busy worker.
+ */
+static void receive_result(struct worker *w) {
+	job_result *result = &w->running->result;
+	uint32_t exit_code;
+	uint32_t timed_out;
+	uint32_t spawn_us;
+
+	if(get_u32(w->sock, &exit_code) == 1 || get_u32(w->sock, &timed_out) == 1
+			|| get_u32(w->sock, &spawn_us) == 1
+			|| (result->log = get_str(w->sock, &result->log_len)) == NULL) {
+		errno = 0;
+		set_error(result, "worker closed connection");
+		w->running->failed = 1;
+		return;
+	}
+	result->exit_code = (int32_t)exit_code;
+	result->timed_out = timed_out;
+	result->spawn_us = (int32_t)spawn_us;
+}
+
+/**
+ * Takes the first job whose result is ready off the done queue.
+ *
+ * @param ex	The executor.
+ * @return		The job, or NULL if no result is ready.
+ */
+static struct entry *take_done(executor *ex) {
+	struct entry *e = ex->done;
+	if(e != NULL && (ex->done = e->next) == NULL) {
+		ex->done_tail = NULL;
+	}
+	return e;
+}
+
+/**
+ * Appends a job to the end of a queue.
+ *
+ * @param head	The first job of the queue.
+ * @param tail	The last job of the queue.
+ * @param e		The job to append.
+ */
+static void push_entry(struct entry **head, struct entry **tail, struct entry *e) {
+	e->next = NULL;
+	if(*tail != NULL) {
+		(*tail)->next = e;
+	} else {
+		*head = e;
+	}
+	*tail = e;
+}
+
+/**
+ * Frees a queue of jobs, along with their messages and results.
+ *
+ * @param e	The first job of the queue, or NULL.
+ */
+static void free_entries(struct entry *e) {
+	while(e != NULL) {
+		struct entry *next = e->next;
+		free(e->msg.data);
+		job_result_free(&e->result);
+		free(e);
+		e = next;
+	}
+}
+
+/**
+ * Resets a result to that of a job that has not run.
+ *
+ * @param result	The result.
+ */
+static void reset_result(job_result *result) {
+	result->exit_code = -1;
+	result->log = NULL;
+	result->log_len = 0;
+	result->timed_out = 0;
+	result->spawn_us = -1;
+	result->error = NULL;
+}
+
+/**
+ * Forks a child that executes a job. A job with a timeout gets a process
+ * group of its own, set up by both parent and child so that it exists
+ * whichever runs first, so the whole group can be killed later, and the
+ * forwarded signals are sent on to it until wait_job has reaped the child.
+ * They are blocked over the fork, so none arrives before its group can be
+ * signalled. Returns only once the child has executed the command, or
+ * exited trying: the child holds the write end of a close-on-exec pipe,
+ * which reads as ended at that moment, so the time this takes is the whole
+ * start of a command.
+ *
+ * @param j				The job to execute.
+ * @param out_fd		Descriptor to send the command's stdout and stderr
+ *						to, or -1 to leave them alone. It is left open in the
+ *						parent.
+ * @param foreground	1 to make the job's group the foreground of the
+ *						terminal on stdin; only for jobs with a timeout.
+ * @return				The pid of the child, or -1 if the fork failed.
+ */
+static pid_t spawn_job(const job *j, int out_fd, int foreground) {
+	int started[2];
+	if(pipe2(started, O_CLOEXEC) == -1) {
+		started[0] = started[1] = -1;
+	}
+
+	// SIGTTOU is blocked too, so the child may take over the terminal
+	sigset_t blocked;
+	sigset_t old_mask;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGTTOU);
+	for(size_t i = 0; i < N_FORWARDED; i++) {
+		sigaddset(&blocked, forwarded_signals[i]);
+	}
+	if(j->timeout > 0) {
+		pthread_sigmask(SIG_BLOCK, &blocked, &old_mask);
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		if(started[0] != -1) {
+			close(started[0]);
+		}
+		if(j->timeout > 0) {
+			setpgid(0, 0);
+			if(foreground) {
+				tcsetpgrp(STDIN_FILENO, getpid());
+			}
+			pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+		}
+		if(out_fd != -1) {
+			dup2(out_fd, STDOUT_FILENO);
+			dup2(out_fd, STDERR_FILENO);
+			close(out_fd);
+		}
+		exec_job(j);
+	}
+	if(j->timeout > 0) {
+		if(pid > 0) {
+			setpgid(pid, pid);
+			if(foreground) {
+				set_foreground(pid);
+			}
+			forward_signals(pid);
+		}
+		pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	}
+
+	// Nothing is ever written; the read ends when the child execs or exits
+	if(started[0] != -1) {
+		close(started[1]);
+		char byte;
+		while(pid > 0 && read(started[0], &byte, 1) == -1 && errno == EINTR) {
+			;
+		}
+		close(started[0]);
+	}
+	return pid;
+}
+
+/**
+ * Waits for a job's child to exit while reading its captured output, in
+ * a single event loop over a pidfd of the child, the output pipe and the
+ * next deadline. When the timeout expires the child's process group is
+ * sent SIGTERM, and KILL_GRACE seconds later SIGKILL; if the pipe is held
+ * open even after that, by a process that left the group, it is given up
+ * on. If the kernel has no pidfds, the loop wakes every EXIT_POLL_MS to
+ * check for the exit without reaping the child, so its pid, and with it
+ * the group, is not reused before the group is killed. Without a timeout
+ * the child is simply waited for once the output ends.
+ *
+ * @param pid		The child, in a process group of its own if timeout > 0.
+ * @param timeout	Seconds the child may run, or 0 for no limit.
+ * @param log_fd	Read end of the pipe capturing the output, or -1. It is
+ *					closed before returning.
+ * @param log		Buffer the output is appended to, or NULL if log_fd is -1.
+ * @param status	Filled with the wait status of the child.
+ * @return			1 if the child timed out, 0 if not, -1 if waiting failed.
+ */
+static int wait_job(pid_t pid, int timeout, int log_fd, struct buffer *log, int *status) {
+	int pidfd = timeout > 0 ? (int)syscall(SYS_pidfd_open, pid, 0) : -1;
+	int exited = 0;
+	int signals_sent = 0;
+	int result;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout;
+
+	while(log_fd != -1 || (timeout > 0 && !exited)) {
+		struct pollfd fds[2];
+		nfds_t n_fds = 0;
+		int wait_ms = timeout > 0 ? ms_until(&deadline) : -1;
+		if(log_fd != -1) {
+			fds[n_fds++] = (struct pollfd){ .fd = log_fd, .events = POLLIN };
+		}
+		if(pidfd != -1 && !exited) {
+			fds[n_fds++] = (struct pollfd){ .fd = pidfd, .events = POLLIN };
+		} else if(timeout > 0 && !exited && wait_ms > EXIT_POLL_MS) {
+			wait_ms = EXIT_POLL_MS;
+		}
+
+		int ready = poll(fds, n_fds, wait_ms);
+		if(ready == -1 && errno == EINTR) {
+			continue;
+		} else if(ready == -1) {
+			break;
+		}
+
+		// Without a pidfd, look for the exit but leave the child unreaped
+		if(timeout > 0 && pidfd == -1 && !exited) {
+			siginfo_t info = {0};
+			exited = waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid;
+		}
+
+		if(ready == 0 && ms_until(&deadline) > 0) {
+			continue;
+		} else if(ready == 0) {
+			// The deadline passed: escalate, or give up on the output
+			if(signals_sent == 2) {
+				break;
+			}
+			kill(-pid, signals_sent == 0 ? SIGTERM : SIGKILL);
+			signals_sent++;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += KILL_GRACE;
+			continue;
+		}
+
+		for(nfds_t i = 0; i < n_fds; i++) {
+			if(fds[i].revents == 0) {
+				continue;
+			} else if(fds[i].fd == pidfd) {
+				exited = 1;
+				continue;
+			}
+			char chunk[READ_CHUNK];
+			ssize_t n = read(log_fd, chunk, sizeof chunk);
+			if(n > 0) {
+				buf_append(log, chunk, n);
+			} else if(n == 0 || errno != EINTR) {
+				close(log_fd);
+				log_fd = -1;
+			}
+		}
+	}
+	if(log_fd != -1) {
+		close(log_fd);
+	}
+	if(pidfd != -1) {
+		close(pidfd);
+	}
+
+	while((result = waitpid(pid, status, 0)) == -1 && errno == EINTR) {
+		;
+	}
+	if(timeout > 0) {
+		forward_signals(0);
+	}
+	return result == -1 ? -1 : signals_sent > 0;
+}
+
+/**
+ * Starts forwarding the signals in forwarded_signals to a job's process
+ * group, saving the actions they replace, or stops and restores them.
+ *
+ * @param group	The job's process group, or 0 to stop forwarding.
+ */
+static void forward_signals(pid_t group) {
+	struct sigaction action = {0};
+	action.sa_handler = forward_signal;
+	sigemptyset(&action.sa_mask);
+
+	if(group == 0) {
+		for(size_t i = 0; i < N_FORWARDED; i++) {
+			sigaction(forwarded_signals[i], &saved_actions[i], NULL);
+		}
+	}
+	job_group = group;
+	if(group != 0) {
+		for(size_t i = 0; i < N_FORWARDED; i++) {
+			sigaction(forwarded_signals[i], &action, &saved_actions[i]);
+		}
+	}
+}
+
+/**
+ * Signal handler sending a signal on to the process group of the running
+ * job, then giving it the effect it had before: the process is ended by
+ * it if it was not handled, and the earlier handler is called if it was.
+ *
+ * @param sig	The signal.
+ */
+static void forward_signal(int sig) {
+	int saved_errno = errno;
+	if(job_group != 0) {
+		kill(-job_group, sig);
+	}
+
+	for(size_t i = 0; i < N_FORWARDED; i++) {
+		if(forwarded_signals[i] != sig) {
+			continue;
+		}
+		if(saved_actions[i].sa_handler == SIG_DFL) {
+			sigaction(sig, &saved_actions[i], NULL);
+			raise(sig);
+		} else if(saved_actions[i].sa_handler != SIG_IGN && !(saved_actions[i].sa_flags & SA_SIGINFO)) {
+			saved_actions[i].sa_handler(sig);
+		}
+	}
+	errno = saved_errno;
+}
+
+/**
+ * Makes a process group the foreground of the terminal on stdin. SIGTTOU
+ * is blocked meanwhile, since taking the terminal back happens from the
+ * background.
+ *
+ * @param group	The process group.
+ */
+static void set_foreground(pid_t group) {
+	sigset_t ttou;
+	sigset_t old_mask;
+	sigemptyset(&ttou);
+	sigaddset(&ttou, SIGTTOU);
+	pthread_sigmask(SIG_BLOCK, &ttou, &old_mask);
+	tcsetpgrp(STDIN_FILENO, group);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+/**
+ * Computes the milliseconds left until a deadline, rounded up so that a
+ * wait does not end just before it.
+ *
+ * @param deadline	The deadline, on the monotonic clock.
+ * @return			The milliseconds left, or 0 if the deadline has passed.
+ */
+static int ms_until(const struct timespec *deadline) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long ns = (deadline->tv_sec - now.tv_sec) * 1000000000LL + (deadline->tv_nsec - now.tv_nsec);
+	if(ns <= 0) {
+		return 0;
+	}
+	long long ms = (ns + 999999) / 1000000;
+	return ms < INT_MAX ? (int)ms : INT_MAX;
+}
+
+/**
+ * Computes the microseconds passed since a time.
+ *
+ * @param start	The time, on the monotonic clock.
+ * @return		The microseconds passed.
+ */
+static long us_since(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+ * Leaves the reason a job could not be run in its result, followed by the
+ * description of errno unless it is 0. Out of memory, the reason is lost.
+ *
+ * @param result	The result of the job.
+ * @param what		What failed.
+ */
+static void set_error(job_result *result, const char *what) {
+	const char *reason = errno != 0 ? strerror(errno) : NULL;
+	size_t len = strlen(what) + (reason != NULL ? strlen(reason) + 2 : 0) + 1;
+	if((result->error = malloc(len)) != NULL) {
+		snprintf(result->error, len, reason != NULL ? "%s: %s" : "%s", what, reason);
+	}
+}
+
+/**
+ * Main loop of a worker process. Reads jobs from the socket, runs each
+ * with its output captured, and writes back the result. Never returns.
+ *
+ * @param sock	The worker's end of the socket.
+ */
+static void worker_loop(int sock) {
+	for(;;) {
+		job j = {0};
+		char **inputs = NULL;
+		char **outputs = NULL;
+		char *cwd = NULL;
+		size_t cwd_len = 0;
+		uint32_t timeout;
+
+		if((j.argv = get_strs(sock)) == NULL || (cwd = get_str(sock, &cwd_len)) == NULL
+				|| (inputs = get_strs(sock)) == NULL || (outputs = get_strs(sock)) == NULL
+				|| get_u32(sock, &timeout) == 1) {
+			_exit(EXIT_SUCCESS);
+		}
+		j.timeout = timeout;
+		j.cwd = cwd_len > 0 ? cwd : NULL;
+		j.inputs = (const char **)inputs;
+		j.outputs = (const char **)outputs;
+
+		// Run the command with stdout and stderr captured through a pipe
+		struct buffer log = {0};
+		int32_t exit_code = -1;
+		int timed_out = 0;
+		long spawn_us = -1;
+		int status;
+		int fds[2];
+		if(j.argv[0] != NULL && pipe(fds) == 0) {
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			pid_t pid = spawn_job(&j, fds[1], 0);
+			spawn_us = pid > 0 ? us_since(&start) : -1;
+			close(fds[1]);
+			if(pid < 0) {
+				close(fds[0]);
+			} else if((timed_out = wait_job(pid, j.timeout, fds[0], &log, &status)) != -1
+					&& WIFEXITED(status)) {
+				exit_code = WEXITSTATUS(status);
+			}
+		}
+
+		struct buffer reply = {0};
+		put_u32(&reply, (uint32_t)exit_code);
+		put_u32(&reply, timed_out == 1);
+		put_u32(&reply, (uint32_t)spawn_us);
+		put_str(&reply, log.data != NULL ? log.data : "", log.len);
+		size_t sent = 0;
+		while(sent < reply.len) {
+			ssize_t n = send(sock, reply.data + sent, reply.len - sent, MSG_NOSIGNAL);
+			if(n == -1) {
+				_exit(EXIT_FAILURE);
+			}
+			sent += n;
+		}
+
+		free(reply.data);
+		free(log.data);
+		free_strs(j.argv);
+		free(cwd);
+		free_strs(inputs);
+		free_strs(outputs);
+	}
+}
+
+/**
+ * Replaces the calling process with a job's command. Only returns to the
+ * caller's parent, as the exit status of the child.
+ *
+ * @param j	The job to execute.
+ */
+static void exec_job(const job *j) {
+	if(j->cwd != NULL && chdir(j->cwd) == -1) {
+		perror("chdir failed");
+		_exit(EXIT_EXEC_FAILED);
+	}
+	execvp(j->argv[0], j->argv);
+	perror("execvp failed");
+	_exit(EXIT_EXEC_FAILED);
+}
+
+/**
+ * Appends bytes to a growable buffer.
+ *
+ * @param buf	The buffer.
+ * @param data	The bytes to append.
+ * @param len	Number of bytes.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int buf_append(struct buffer *buf, const void *data, size_t len) {
+	if(buf->len + len > buf->cap) {
+		size_t cap = buf->cap != 0 ? buf->cap : 256;
+		while(cap < buf->len + len) {
+			cap *= 2;
+		}
+		char *data_new = realloc(buf->data, cap);
+		if(data_new == NULL) {
+			return 1;
+		}
+		buf->data = data_new;
+		buf->cap = cap;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+/**
+ * Encodes a 32-bit integer.
+ *
+ * @param buf	The message being encoded.
+ * @param value	The value.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int put_u32(struct buffer *buf, uint32_t value) {
+	return buf_append(buf, &value, sizeof value);
+}
+
+/**
+ * Encodes a string as its length followed by its bytes.
+ *
+ * @param buf	The message being encoded.
+ * @param str	The string.
+ * @param len	Length of the string.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int put_str(struct buffer *buf, const char *str, size_t len) {
+	if(put_u32(buf, len) == 1) {
+		return 1;
+	}
+	return buf_append(buf, str, len);
+}
+
+/**
+ * Encodes a NULL-terminated string array as a count followed by the
+ * strings.
+ *
+ * @param buf	The message being encoded.
+ * @param strs	The array.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int put_strs(struct buffer *buf, const char **strs) {
+	uint32_t count = 0;
+	while(strs[count] != NULL) {
+		count++;
+	}
+	if(put_u32(buf, count) == 1) {
+		return 1;
+	}
+	for(uint32_t i = 0; i < count; i++) {
+		if(put_str(buf, strs[i], strlen(strs[i])) == 1) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reads exactly len bytes from a file descriptor.
+ *
+ * @param fd	The file descriptor.
+ * @param data	Buffer to fill.
+ * @param len	Number of bytes to read.
+ * @return		0 on success, 1 on error or end of file.
+ */
+static int read_full(int fd, void *data, size_t len) {
+	char *p = data;
+	while(len > 0) {
+		ssize_t n = read(fd, p, len);
+		if(n <= 0) {
+			return 1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Decodes a 32-bit integer.
+ *
+ * @param fd	The socket to read from.
+ * @param value	Filled with the value.
+ * @return		0 on success, 1 on error or end of file.
+ */
+static int get_u32(int fd, uint32_t *value) {
+	return read_full(fd, value, sizeof *value);
+}
+
+/**
+ * Decodes a string. The returned string should be freed using free.
+ *
+ * @param fd	The socket to read from.
+ * @param len	Filled with the length of the string.
+ * @return		The NUL-terminated string, or NULL on error or end of file.
+ */
+static char *get_str(int fd, size_t *len) {
+	uint32_t n;
+	if(get_u32(fd, &n) == 1) {
+		return NULL;
+	}
+	char *str = malloc((size_t)n + 1);
+	if(str == NULL || read_full(fd, str, n) == 1) {
+		free(str);
+		return NULL;
+	}
+	str[n] = '\0';
+	*len = n;
+	return str;
+}
+
+/**
+ * Decodes a string array. The returned array should be freed using
+ * free_strs.
+ *
+ * @param fd	The socket to read from.
+ * @return		NULL-terminated array, or NULL on error or end of file.
+ */
+static char **get_strs(int fd) {
+	uint32_t count;
+	size_t len;
+	if(get_u32(fd, &count) == 1) {
+		return NULL;
+	}
+	char **strs = calloc((size_t)count + 1, sizeof *strs);
+	if(strs == NULL) {
+		return NULL;
+	}
+	for(uint32_t i = 0; i < count; i++) {
+		if((strs[i] = get_str(fd, &len)) == NULL) {
+			free_strs(strs);
+			return NULL;
+		}
+	}
+	return strs;
+}
+
+/**
+ * Frees a string array returned by get_strs.
+ *
+ * @param strs	The array, or NULL.
+ */
+static void free_strs(char **strs) {
+	if(strs == NULL) {
+		return;
+	}
+	for(int i = 0; strs[i] != NULL; i++) {
+		free(strs[i]);
+	}
+	free(strs);
+}
@@ -0,0 +1,183 @@
+/**
+ * executor.h - Runs build commands on behalf of the build logic.
+ *
+ * A job describes one command: its arguments, working directory, the
+ * files it reads and the files it is expected to produce. An executor
+ * runs jobs and reports the exit code and any captured log output. Jobs
+ * are submitted without waiting for them, and their results collected as
+ * they come in, so several may run at once. A job may carry a timeout:
+ * the local and worker executors then run its command in a process group
+ * of its own, and kill the whole group once the time is up, first with
+ * SIGTERM and, if it is still running after a grace period, with SIGKILL.
+ * Signals that would end mmake meanwhile are passed on to that group
+ * first, and a local job run from a terminal holds the terminal's
+ * foreground while it runs. Three executors exist:
+ *
+ *  - local:   forks and executes the command directly, output goes to
+ *             mmake's own stdout and stderr. Jobs run one at a time, as
+ *             they are submitted.
+ *  - workers: sends the job over a Unix socket to an idle one of a pool of
+ *             worker processes, which runs it and sends back the result
+ *             and the captured output. Jobs submitted while every worker
+ *             is busy wait in a queue. This is the same protocol a remote
+ *             worker would speak.
+ *  - custom:  hands each job to a function supplied by the caller, for
+ *             programs embedding mmake that run commands themselves, as
+ *             it is submitted.
+ *
+ * Functions:
+ *  - executor_local(): Creates an executor that forks commands directly.
+ *  - executor_workers(): Creates an executor backed by worker processes.
+ *  - executor_custom(): Creates an executor that calls a caller's function.
+ *  - executor_submit(): Submits a job without waiting for it.
+ *  - executor_collect(): Waits for the result of a submitted job.
+ *  - executor_in_flight(): Counts the jobs submitted but not collected.
+ *  - executor_run(): Runs a job and waits for its result.
+ *  - executor_del(): Stops an executor and frees its memory.
+ *  - job_result_free(): Frees the memory held by a job result.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-23
+ * @Version:	1.0
+ */
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stddef.h>
+
+typedef struct executor executor;
+
+/**
+ * A command to run.
+ *
+ * argv		The command and its arguments, terminated with NULL.
+ * cwd		Directory to run the command in, or NULL for the current one.
+ * inputs	Files the command reads, terminated with NULL, or NULL if not known.
+ * outputs	Files the command is expected to produce, terminated with NULL, or NULL.
+ * timeout	Seconds the command may run before it is killed, or 0 for no limit.
+ */
+typedef struct job {
+	char **argv;
+	const char *cwd;
+	const char **inputs;
+	const char **outputs;
+	int timeout;
+} job;
+
+/**
+ * The result of a job.
+ *
+ * exit_code	Exit status of the command, or -1 if it did not exit normally.
+ * log			Captured output of the command, or NULL if it was not captured.
+ * log_len		Length of log in bytes.
+ * timed_out	1 if the command was killed because its timeout expired.
+ * spawn_us		Microseconds from forking the command until it was executed,
+ *				or -1 if not known.
+ * error		Why the job could not be run, or NULL. Set by the local and
+ *				worker executors when the job is collected as not run.
+ */
+typedef struct job_result {
+	int exit_code;
+	char *log;
+	size_t log_len;
+	int timed_out;
+	long spawn_us;
+	char *error;
+} job_result;
+
+/**
+ * Creates an executor that forks and executes each command directly.
+ *
+ * @return	The executor, or NULL if out of memory.
+ */
+executor *executor_local(void);
+
+/**
+ * Creates an executor backed by a pool of worker processes, each reached
+ * over its own Unix socket.
+ *
+ * @param n_workers	Number of worker processes to start.
+ * @return			The executor, or NULL with errno set if the workers could
+ *					not be started.
+ */
+executor *executor_workers(int n_workers);
+
+/**
+ * Creates an executor that runs each job by calling a function supplied
+ * by the caller. The function fills in the result as executor_run would,
+ * and is responsible for enforcing the job's timeout if it has one; a log
+ * or error it sets must be allocated with malloc, since job_result_free
+ * frees them.
+ *
+ * @param run	Runs a job. Returns 0 if the job was run, 1 if it could not
+ *				be started.
+ * @param ctx	Passed as the first argument of run.
+ * @return		The executor, or NULL if out of memory.
+ */
+executor *executor_custom(int (*run)(void *ctx, const job *j, job_result *result), void *ctx);
+
+/**
+ * Submits a job without waiting for it to run. The job is encoded or run
+ * before returning, so it need not outlive the call. Its result must be
+ * collected with executor_collect.
+ *
+ * @param ex	The executor.
+ * @param j		The job to run.
+ * @param tag	Handed back with the result, to tell the jobs apart.
+ * @return		0 if the job was submitted, 1 if out of memory.
+ */
+int executor_submit(executor *ex, const job *j, void *tag);
+
+/**
+ * Waits for the result of any submitted job, returning the first one to
+ * come in. Must only be called while jobs are in flight. The caller is
+ * responsible for freeing the result with job_result_free, whether the job
+ * ran or not.
+ *
+ * @param ex		The executor.
+ * @param result	Filled with the result of the job.
+ * @param tag		Filled with the tag the job was submitted with.
+ * @return			0 if the job was run, 1 if it could not be started.
+ */
+int executor_collect(executor *ex, job_result *result, void **tag);
+
+/**
+ * Counts the jobs submitted but not yet collected.
+ *
+ * @param ex	The executor.
+ * @return		The number of jobs in flight.
+ */
+size_t executor_in_flight(executor *ex);
+
+/**
+ * Runs a job and waits for its result, or until its timeout expires and
+ * its command has been killed. Nothing is printed; if the job could not be
+ * run, the reason is left in the result. The caller is responsible for
+ * freeing the result with job_result_free, whether the job ran or not.
+ * Results of other jobs in flight that come in meanwhile are left to be
+ * collected.
+ *
+ * @param ex		The executor.
+ * @param j			The job to run.
+ * @param result	Filled with the result of the job.
+ * @return			0 if the job was run, 1 if it could not be started.
+ */
+int executor_run(executor *ex, const job *j, job_result *result);
+
+/**
+ * Stops an executor, waiting for any worker processes to exit, and frees
+ * its memory. The results of jobs still in flight are discarded.
+ *
+ * @param ex	The executor.
+ */
+void executor_del(executor *ex);
+
+/**
+ * Frees the memory held by a job result.
+ *
+ * @param result	The result.
+ */
+void job_result_free(job_result *result);
+
+#endif
@@ -0,0 +1,61 @@
+/**
+ * hash.c - Non-cryptographic content hashing.
+ *
+ * Provides a 64-bit FNV-1a hash used to fingerprint makefiles and file
+ * contents.
+ *
+ * Functions:
+ *  - hash_bytes(): Feeds a block of bytes into a running hash.
+ *  - hash_str(): Hashes a NUL-terminated string.
+ *  - hash_file(): Hashes the full contents of a file.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-21
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "hash.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define FNV_PRIME 0x100000001b3ULL
+#define READ_CHUNK 65536
+
+/* -------------------------- External functions -------------------------- */
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+	const unsigned char *p = data;
+	for(size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+uint64_t hash_str(const char *str) {
+	return hash_bytes(HASH_INIT, str, strlen(str));
+}
+
+int hash_file(const char *path, uint64_t *digest) {
+	unsigned char buf[READ_CHUNK];
+	size_t n;
+	uint64_t hash = HASH_INIT;
+
+	FILE *fp = fopen(path, "rb");
+	if(fp == NULL) {
+		return 1;
+	}
+	while((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+		hash = hash_bytes(hash, buf, n);
+	}
+	if(ferror(fp)) {
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	*digest = hash;
+	return 0;
+}
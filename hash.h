@@ -0,0 +1,54 @@
+/**
+ * hash.h - Non-cryptographic content hashing.
+ *
+ * Provides a 64-bit FNV-1a hash used to fingerprint makefiles and file
+ * contents. The hash is fast and stable across runs, which is all the
+ * caches in mmake need; it is not meant to resist deliberate collisions.
+ *
+ * Functions:
+ *  - hash_bytes(): Feeds a block of bytes into a running hash.
+ *  - hash_str(): Hashes a NUL-terminated string.
+ *  - hash_file(): Hashes the full contents of a file.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-21
+ * @Version:	1.0
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Initial value of a running hash (the FNV-1a 64-bit offset basis). */
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Feeds a block of bytes into a running hash.
+ *
+ * @param hash	The running hash, HASH_INIT for a new hash.
+ * @param data	The bytes to hash.
+ * @param len	Number of bytes in data.
+ * @return		The updated hash.
+ */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len);
+
+/**
+ * Hashes a NUL-terminated string.
+ *
+ * @param str	The string to hash.
+ * @return		The hash of the string.
+ */
+uint64_t hash_str(const char *str);
+
+/**
+ * Hashes the full contents of a file.
+ *
+ * @param path		Path to the file.
+ * @param digest	Filled with the hash of the file contents.
+ * @return			0 on success, 1 if the file could not be read.
+ */
+int hash_file(const char *path, uint64_t *digest);
+
+#endif
@@ -0,0 +1,421 @@
+/**
+ * libmmake.c - The mmake build engine as a library.
+ *
+ * Ties the parser, the caches, the deps log and the build logic together
+ * behind one handle. The executor is only started by the first build, so
+ * loading an engine to query its graph forks nothing. Each build gets its
+ * own batch set, so batches never leak from one build into the next, and
+ * its own stat cache, since files change between builds.
+ *
+ * With metrics, each build adds the number of targets reachable
+ * from its goals, through declared and discovered prerequisites, to the
+ * total. They are counted by one walk of the graph before the build
+ * starts, flagging the rules visited in the array the build then flags
+ * the targets it counts as done in, so the walk allocates nothing. The
+ * targets counted as done are flagged in an array of the build's own, so
+ * builds never write to the makefile, which queries may read meanwhile.
+ *
+ * Functions:
+ *  - mmake_load(): Loads a makefile into a new engine.
+ *  - mmake_makefile(): Returns the parsed makefile of an engine.
+ *  - mmake_discovered(): Returns the prerequisites discovered for a target.
+ *  - mmake_affected(): Prints the targets that depend on changed files.
+ *  - mmake_metrics(): Returns the metrics of an engine.
+ *  - mmake_plan(): Reports the commands a build would run.
+ *  - mmake_build(): Builds targets.
+ *  - mmake_free(): Frees an engine.
+ *  - load_makefile(): Loads a makefile, from its image if possible.
+ *  - load_timeouts(): Reads the timeouts of single targets from .TIMEOUT.
+ *  - new_stats(): Creates the stat cache of a build.
+ *  - count_reachable(): Counts the targets reachable from a target.
+ *  - run_goals(): Handles every goal of a build or plan.
+ *  - report(): Reports an error through the progress callbacks.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-28
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "libmmake.h"
+#include "cache.h"
+#include "deps.h"
+#include "batch.h"
+#include "affected.h"
+#include "strmap.h"
+#include "statcache.h"
+#include "stamps.h"
+#include "metrics.h"
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct mmake {
+	mmake_config config;
+	makefile *mmakefile;
+	deps_log *deps;
+	stamps_log *stamps;
+	executor *exec;
+	int owns_exec;
+	affected_index *affected;
+	strmap *timeouts;
+	metrics *metrics;
+	metrics_counters *counters;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static makefile *load_makefile(const char *path, const mmake_config *config);
+static int load_timeouts(mmake *m);
+static statcache *new_stats(mmake *m);
+static int64_t count_reachable(mmake *m, const char *target, unsigned char *seen);
+static int run_goals(mmake *m, const char **goals, int n_goals, build_opts *opts);
+static void report(const mmake_config *config, const char *target, const char *message);
+
+/* -------------------------- External functions -------------------------- */
+
+mmake *mmake_load(const char *path, const mmake_config *config) {
+	mmake *m = calloc(1, sizeof *m);
+	if(m == NULL) {
+		report(config, NULL, "Out of memory");
+		return NULL;
+	}
+	m->config = *config;
+
+	if(config->metrics || config->metrics_path != NULL) {
+		if((m->metrics = metrics_new()) == NULL || (m->counters = metrics_counters_new(m->metrics)) == NULL) {
+			report(config, NULL, "Out of memory");
+			metrics_del(m->metrics);
+			free(m);
+			return NULL;
+		}
+	}
+
+	m->mmakefile = load_makefile(path, config);
+	if(m->mmakefile == NULL) {
+		metrics_del(m->metrics);
+		free(m);
+		return NULL;
+	}
+	m->deps = deps_log_open(DEPS_LOG, m->mmakefile);
+	m->stamps = stamps_log_open(STAMPS_LOG);
+	if(m->deps == NULL || m->stamps == NULL) {
+		report(config, NULL, "Out of memory");
+		mmake_free(m);
+		return NULL;
+	}
+	if(load_timeouts(m) == 1) {
+		mmake_free(m);
+		return NULL;
+	}
+
+	// Without its directory the artifact cache could never store anything
+	if(config->artifact_dir != NULL && mkdir(config->artifact_dir, 0777) == -1 && errno != EEXIST) {
+		report(config, config->artifact_dir, strerror(errno));
+		m->config.artifact_dir = NULL;
+	}
+	return m;
+}
+
+makefile *mmake_makefile(mmake *m) {
+	return m->mmakefile;
+}
+
+const char **mmake_discovered(mmake *m, const char *target) {
+	return deps_log_get(m->deps, target);
+}
+
+int mmake_affected(mmake *m, char **files, int n_files, FILE *out) {
+	if(m->affected == NULL && (m->affected = affected_index_new(m->mmakefile, m->deps)) == NULL) {
+		report(&m->config, NULL, "Could not index makefile");
+		return 1;
+	}
+	int result = affected_print(m->affected, files, n_files, out);
+	if(result == 2) {
+		report(&m->config, NULL, "Dependency cycle among affected targets");
+	} else if(result == 1) {
+		report(&m->config, NULL, "Out of memory");
+	}
+	return result != 0;
+}
+
+metrics *mmake_metrics(mmake *m) {
+	return m->metrics;
+}
+
+int mmake_plan(mmake *m, const char **goals, int n_goals) {
+	build_opts opts = {0};
+	opts.force_build = m->config.force_build;
+	opts.deps = m->deps;
+	opts.stamps = m->stamps;
+	opts.progress = m->config.progress;
+	opts.stats = new_stats(m);
+
+	if((opts.planned = strmap_new()) == NULL) {
+		report(&m->config, NULL, "Out of memory");
+		statcache_del(opts.stats);
+		return 1;
+	}
+	int result = run_goals(m, goals, n_goals, &opts);
+	strmap_del(opts.planned);
+	statcache_del(opts.stats);
+	return result;
+}
+
+int mmake_build(mmake *m, const char **goals, int n_goals) {
+	build_opts opts = {0};
+
+	// Start the executor that runs the commands on the first build
+	if(m->exec == NULL) {
+		if(m->config.exec != NULL) {
+			m->exec = m->config.exec;
+		} else {
+			m->exec = m->config.n_workers > 0 ? executor_workers(m->config.n_workers) : executor_local();
+			m->owns_exec = 1;
+		}
+		if(m->exec == NULL) {
+			char message[128];
+			snprintf(message, sizeof message, "Could not start executor: %s", strerror(errno));
+			report(&m->config, NULL, message);
+			return 1;
+		}
+	}
+	opts.batches = batch_set_new(m->mmakefile);
+	opts.failed = strmap_new();
+	opts.running = calloc(makefile_rule_count(m->mmakefile), 1);
+	if(m->metrics != NULL) {
+		opts.done = calloc(makefile_rule_count(m->mmakefile), 1);
+	}
+	if(opts.batches == NULL || opts.failed == NULL || opts.running == NULL
+			|| (m->metrics != NULL && opts.done == NULL)) {
+		report(&m->config, NULL, "Out of memory");
+		batch_set_del(opts.batches);
+		strmap_del(opts.failed);
+		free(opts.running);
+		free(opts.done);
+		return 1;
+	}
+	opts.force_build = m->config.force_build;
+	opts.artifact_dir = m->config.artifact_dir;
+	opts.exec = m->exec;
+	opts.deps = m->deps;
+	opts.stamps = m->stamps;
+	opts.progress = m->config.progress;
+	opts.stats = new_stats(m);
+	opts.timeout = m->config.timeout;
+	opts.timeouts = m->timeouts;
+
+	// Count the progress, exporting it while the build runs if asked to
+	if(m->metrics != NULL) {
+		int64_t total = 0;
+		if(goals == NULL || n_goals == 0) {
+			total = count_reachable(m, makefile_default_target(m->mmakefile), opts.done);
+		}
+		for(int i = 0; goals != NULL && i < n_goals; i++) {
+			total += count_reachable(m, goals[i], opts.done);
+		}
+		memset(opts.done, 0, makefile_rule_count(m->mmakefile));
+		opts.counters = m->counters;
+		metrics_add(m->counters, METRIC_TARGETS_TOTAL, total);
+		const build_progress *progress = m->config.progress;
+		void (*tick)(void *ctx) = progress != NULL ? progress->tick : NULL;
+		if((m->config.metrics_path != NULL || tick != NULL)
+				&& metrics_export_start(m->metrics, m->config.metrics_path, tick, progress != NULL ? progress->ctx : NULL) == 1) {
+			report(&m->config, m->config.metrics_path, "Could not export metrics");
+		}
+	}
+
+	// Build the targets still waiting in batches once the goals are handled,
+	// and wait for every command left in flight, even after a failure
+	int result = run_goals(m, goals, n_goals, &opts);
+	if(result == 0) {
+		result = flush_batches(&opts);
+	}
+	if(wait_commands(&opts) == 1) {
+		result = 1;
+	}
+	if(strmap_count(opts.failed) > 0) {
+		result = 1;
+	}
+	if(m->metrics != NULL) {
+		metrics_export_stop(m->metrics);
+	}
+	batch_set_del(opts.batches);
+	strmap_del(opts.failed);
+	statcache_del(opts.stats);
+	free(opts.running);
+	free(opts.done);
+	return result;
+}
+
+void mmake_free(mmake *m) {
+	if(m == NULL) {
+		return;
+	}
+	if(m->owns_exec) {
+		executor_del(m->exec);
+	}
+	affected_index_del(m->affected);
+	metrics_del(m->metrics);
+	strmap_del(m->timeouts);
+	deps_log_close(m->deps);
+	stamps_log_close(m->stamps);
+	makefile_del(m->mmakefile);
+	free(m);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Loads a makefile from its pre-compiled image if enabled and still valid,
+ * otherwise parses it and, if enabled, stores its image for the next load.
+ *
+ * @param path		Path of the makefile.
+ * @param config	Configuration of the engine.
+ * @return			The parsed makefile, or NULL on error.
+ */
+static makefile *load_makefile(const char *path, const mmake_config *config) {
+	makefile *mmakefile = NULL;
+	int use_cache = config->use_cache;
+	cache_key key;
+
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL) {
+		report(config, path, "No such file or directory");
+		return NULL;
+	}
+
+	if(use_cache && cache_key_init(&key, path, fp) == 1) {
+		use_cache = 0;
+	}
+	if(use_cache) {
+		mmakefile = cache_load(&key);
+	}
+
+	if(mmakefile == NULL) {
+		mmakefile = parse_makefile(fp);
+		if(mmakefile == NULL) {
+			report(config, path, "Could not parse makefile");
+		} else if(use_cache && cache_store(&key, mmakefile) == 1) {
+			report(config, path, "Could not write makefile cache");
+		}
+	}
+	fclose(fp);
+	return mmakefile;
+}
+
+/**
+ * Reads the timeouts of single targets from every .TIMEOUT rule, whose
+ * first prerequisite is the number of seconds. A target listed more than
+ * once keeps its first timeout, as a target keeps its first rule.
+ *
+ * @param m	The engine.
+ * @return	0 on success, 1 if a timeout is invalid or out of memory.
+ */
+static int load_timeouts(mmake *m) {
+	for(rule *r = makefile_first_rule(m->mmakefile); r != NULL; r = rule_next(r)) {
+		if(strcmp(rule_target(r), TIMEOUT_TARGET) != 0) {
+			continue;
+		}
+
+		const char **prereq = rule_prereq(r);
+		char *end = NULL;
+		long seconds = prereq[0] != NULL ? strtol(prereq[0], &end, 10) : 0;
+		if(seconds <= 0 || seconds > INT_MAX || *end != '\0') {
+			report(&m->config, TIMEOUT_TARGET, "Expected a number of seconds");
+			return 1;
+		}
+		if(m->timeouts == NULL && (m->timeouts = strmap_new()) == NULL) {
+			report(&m->config, NULL, "Out of memory");
+			return 1;
+		}
+		for(int index = 1; prereq[index] != NULL; index++) {
+			if(strmap_get(m->timeouts, prereq[index]) == NULL
+					&& strmap_put(m->timeouts, prereq[index], (void *)prereq[0]) == 1) {
+				report(&m->config, NULL, "Out of memory");
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Creates the stat cache of a build. Each build gets a new one, since
+ * files may change between builds.
+ *
+ * @param m	The engine.
+ * @return	The cache, owned by the caller, or NULL to stat without one.
+ */
+static statcache *new_stats(mmake *m) {
+	statcache *stats = statcache_new(m->mmakefile);
+	if(stats != NULL) {
+		statcache_count(stats, m->counters);
+	}
+	return stats;
+}
+
+/**
+ * Counts the targets reachable from a target, through its declared and
+ * its discovered prerequisites, that have not been counted yet. Special
+ * targets are left out.
+ *
+ * @param m			The engine.
+ * @param target	The target to start from.
+ * @param seen		Flags of the rules already counted, indexed by rule_index.
+ * @return			The number of targets counted.
+ */
+static int64_t count_reachable(mmake *m, const char *target, unsigned char *seen) {
+	rule *r = makefile_rule(m->mmakefile, target);
+	if(r == NULL || seen[rule_index(r)]) {
+		return 0;
+	}
+	seen[rule_index(r)] = 1;
+
+	int64_t count = target[0] != '.';
+	const char **lists[2] = { rule_prereq(r), deps_log_get(m->deps, target) };
+	for(int l = 0; l < 2; l++) {
+		for(int index = 0; lists[l] != NULL && lists[l][index] != NULL; index++) {
+			count += count_reachable(m, lists[l][index], seen);
+		}
+	}
+	return count;
+}
+
+/**
+ * Handles every goal of a build or plan, stopping at the first failure.
+ *
+ * @param m			The engine.
+ * @param goals		The goals, or NULL for the default target.
+ * @param n_goals	Number of goals.
+ * @param opts		Options of the build.
+ * @return			0 on success, 1 on error
+ */
+static int run_goals(mmake *m, const char **goals, int n_goals, build_opts *opts) {
+	if(goals == NULL || n_goals == 0) {
+		return handle_target(makefile_default_target(m->mmakefile), m->mmakefile, opts);
+	}
+	for(int i = 0; i < n_goals; i++) {
+		if(handle_target(goals[i], m->mmakefile, opts) == 1) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reports an error through the progress callbacks, if there are any.
+ *
+ * @param config	Configuration holding the callbacks.
+ * @param target	The file or target the error concerns, or NULL.
+ * @param message	Description of the error.
+ */
+static void report(const mmake_config *config, const char *target, const char *message) {
+	if(config->progress != NULL && config->progress->error != NULL) {
+		config->progress->error(config->progress->ctx, target, message);
+	}
+}
@@ -0,0 +1,160 @@
+/**
+ * libmmake.h - The mmake build engine as a library.
+ *
+ * Lets a program keep a parsed makefile resident and build from it
+ * repeatedly, instead of running mmake as a subprocess. An engine is
+ * loaded once from a makefile; its graph can then be queried, builds
+ * planned and run any number of times. Commands run on the executor given
+ * in the configuration (see executor_custom to run them yourself), and
+ * progress is reported through callbacks rather than printed. The engine
+ * holds no global state and never exits the process, so several engines
+ * may exist side by side; each one must only be used by one thread at a
+ * time. Paths are resolved against the current working directory.
+ *
+ * Link with libmmake.a or libmmake.so. The graph is queried with the
+ * accessors in parser.h (makefile_rule, rule_prereq, rule_cmd, ...) on
+ * the makefile returned by mmake_makefile.
+ *
+ * Functions:
+ *  - mmake_load(): Loads a makefile into a new engine.
+ *  - mmake_makefile(): Returns the parsed makefile of an engine.
+ *  - mmake_discovered(): Returns the prerequisites discovered for a target.
+ *  - mmake_affected(): Prints the targets that depend on changed files.
+ *  - mmake_metrics(): Returns the metrics of an engine.
+ *  - mmake_plan(): Reports the commands a build would run.
+ *  - mmake_build(): Builds targets.
+ *  - mmake_free(): Frees an engine.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-28
+ * @Version:	1.0
+ */
+
+#ifndef LIBMMAKE_H
+#define LIBMMAKE_H
+
+#include <stdio.h>
+#include "parser.h"
+#include "executor.h"
+#include "target.h"
+#include "metrics.h"
+
+typedef struct mmake mmake;
+
+/**
+ * Configuration of an engine. Zero-initialise it and set what is needed.
+ *
+ * use_cache		If true, load and store a pre-compiled image of the makefile.
+ * force_build		If true, every build rebuilds all targets.
+ * artifact_dir		Directory of the artifact cache, created if missing, or
+ *					NULL if disabled. The cache is disabled, with an error
+ *					reported, if the directory cannot be created.
+ * n_workers		Number of worker processes to run commands on, or 0 to
+ *					fork them directly. Ignored if exec is set.
+ * exec				Executor to run commands on, or NULL to create one. It is
+ *					not freed by the engine.
+ * progress			Callbacks reporting the progress of builds and any errors,
+ *					or NULL. It must outlive the engine.
+ * timeout			Seconds any command may run before it is killed, or 0 for
+ *					no limit. Targets listed under .TIMEOUT get their own.
+ * metrics			If true, count the progress of builds in metrics, read with
+ *					mmake_metrics.
+ * metrics_path		If not NULL, count as with metrics, and export the metrics
+ *					to this file in the Prometheus text format every second
+ *					while a build runs.
+ */
+typedef struct mmake_config {
+	int use_cache;
+	int force_build;
+	const char *artifact_dir;
+	int n_workers;
+	executor *exec;
+	const build_progress *progress;
+	int timeout;
+	int metrics;
+	const char *metrics_path;
+} mmake_config;
+
+/**
+ * Loads a makefile into a new engine. Errors are reported through the
+ * error callback of the configuration. The caller is responsible for
+ * freeing the engine with mmake_free.
+ *
+ * @param path		Path of the makefile.
+ * @param config	Configuration of the engine. It is copied.
+ * @return			The engine, or NULL on error.
+ */
+mmake *mmake_load(const char *path, const mmake_config *config);
+
+/**
+ * Returns the parsed makefile of an engine, to be queried with the
+ * functions in parser.h. It is owned by the engine.
+ *
+ * @param m	The engine.
+ * @return	The parsed makefile.
+ */
+makefile *mmake_makefile(mmake *m);
+
+/**
+ * Returns the prerequisites discovered from the depfile of a target by its
+ * last build.
+ *
+ * @param m			The engine.
+ * @param target	The target.
+ * @return			NULL-terminated array, or NULL if none are recorded.
+ */
+const char **mmake_discovered(mmake *m, const char *target);
+
+/**
+ * Prints, one per line and in build order, every target that depends
+ * directly or transitively on one of the changed files.
+ *
+ * @param m			The engine.
+ * @param files		The changed files.
+ * @param n_files	Number of changed files.
+ * @param out		Where to print the targets.
+ * @return			0 on success, 1 on error
+ */
+int mmake_affected(mmake *m, char **files, int n_files, FILE *out);
+
+/**
+ * Returns the metrics of an engine, counting the progress of its builds,
+ * to be read with the functions in metrics.h. They are owned by the
+ * engine and may be read from any thread.
+ *
+ * @param m	The engine.
+ * @return	The metrics, or NULL if the engine keeps none.
+ */
+metrics *mmake_metrics(mmake *m);
+
+/**
+ * Reports, through the command callback, every command a build of the
+ * goals would run, without running anything.
+ *
+ * @param m			The engine.
+ * @param goals		The targets to plan, or NULL for the default target.
+ * @param n_goals	Number of goals.
+ * @return			0 on success, 1 on error
+ */
+int mmake_plan(mmake *m, const char **goals, int n_goals);
+
+/**
+ * Builds the goals, stopping at the first failure. A command that times
+ * out is no such failure: its target and the targets depending on it are
+ * not built, the rest of the build carries on, and the build then fails.
+ *
+ * @param m			The engine.
+ * @param goals		The targets to build, or NULL for the default target.
+ * @param n_goals	Number of goals.
+ * @return			0 on success, 1 if a target could not be built.
+ */
+int mmake_build(mmake *m, const char **goals, int n_goals);
+
+/**
+ * Frees an engine, stopping any executor it created.
+ *
+ * @param m	The engine, or NULL.
+ */
+void mmake_free(mmake *m);
+
+#endif
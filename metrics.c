@@ -0,0 +1,284 @@
+/**
+ * metrics.c - Counters describing the progress of builds.
+ *
+ * Blocks of counters are kept in a list that only grows; the lock guards
+ * the list, never the counters. A counter is an atomic value with one
+ * writer, which adds to it with a relaxed load and store, so a reader
+ * merging the blocks sees each value whole without slowing the writer.
+ *
+ * Functions:
+ *  - metrics_new(): Creates a set of metrics with no counters.
+ *  - metrics_counters_new(): Adds a block of counters for one thread.
+ *  - metrics_add(): Adds to a counter in a block.
+ *  - metrics_read(): Reads every metric, merged over all blocks.
+ *  - metrics_write(): Writes every metric in the Prometheus text format.
+ *  - metrics_status(): Formats the metrics as a one-line status.
+ *  - metrics_export_start(): Starts exporting the metrics every second.
+ *  - metrics_export_stop(): Stops exporting, after a final export.
+ *  - metrics_del(): Frees a set of metrics and its counters.
+ *  - export_loop(): Main loop of the export thread.
+ *  - export_file(): Replaces the export file with the current metrics.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-11-01
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "metrics.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define EXPORT_INTERVAL_SEC 1
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct metrics_counters {
+	metrics_counters *next;
+	_Atomic int64_t values[METRIC_COUNT];
+};
+
+struct metrics {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	metrics_counters *counters;
+	char *export_path;
+	void (*tick)(void *ctx);
+	void *tick_ctx;
+	pthread_t export_thread;
+	int exporting;
+	int stop;
+};
+
+/*
+ * Prometheus name, type and help text of every metric but the spawn
+ * latency, which is written as a summary of METRIC_SPAWN_US over
+ * METRIC_SPAWNS.
+ */
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} metric_info[METRIC_SPAWNS] = {
+	{ "mmake_targets_total", "counter", "Targets reachable from the goals of builds." },
+	{ "mmake_targets_done_total", "counter", "Targets found up to date, built or restored." },
+	{ "mmake_targets_failed_total", "counter", "Targets that timed out or depend on one that did." },
+	{ "mmake_jobs_running", "gauge", "Commands currently running." },
+	{ "mmake_queue_depth", "gauge", "Targets waiting in batches." },
+	{ "mmake_commands_total", "counter", "Commands run." },
+	{ "mmake_stat_cache_hits_total", "counter", "File status lookups answered by the stat cache." },
+	{ "mmake_stat_cache_misses_total", "counter", "File status lookups that went to the file system." },
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void *export_loop(void *arg);
+static void export_file(metrics *m);
+
+/* -------------------------- External functions -------------------------- */
+
+metrics *metrics_new(void) {
+	metrics *m = calloc(1, sizeof *m);
+	if(m == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->cond, NULL);
+	return m;
+}
+
+metrics_counters *metrics_counters_new(metrics *m) {
+	metrics_counters *counters = malloc(sizeof *counters);
+	if(counters == NULL) {
+		return NULL;
+	}
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		atomic_init(&counters->values[i], 0);
+	}
+
+	pthread_mutex_lock(&m->lock);
+	counters->next = m->counters;
+	m->counters = counters;
+	pthread_mutex_unlock(&m->lock);
+	return counters;
+}
+
+void metrics_add(metrics_counters *counters, int metric, int64_t n) {
+	if(counters == NULL) {
+		return;
+	}
+	// Only this thread writes the counter, so no read-modify-write is needed
+	_Atomic int64_t *value = &counters->values[metric];
+	atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void metrics_read(metrics *m, int64_t values[METRIC_COUNT]) {
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		values[i] = 0;
+	}
+	pthread_mutex_lock(&m->lock);
+	for(metrics_counters *counters = m->counters; counters != NULL; counters = counters->next) {
+		for(int i = 0; i < METRIC_COUNT; i++) {
+			values[i] += atomic_load_explicit(&counters->values[i], memory_order_relaxed);
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+}
+
+int metrics_write(metrics *m, FILE *out) {
+	int64_t values[METRIC_COUNT];
+	metrics_read(m, values);
+
+	for(int i = 0; i < METRIC_SPAWNS; i++) {
+		fprintf(out, "# HELP %s %s\n", metric_info[i].name, metric_info[i].help);
+		fprintf(out, "# TYPE %s %s\n", metric_info[i].name, metric_info[i].type);
+		fprintf(out, "%s %" PRId64 "\n", metric_info[i].name, values[i]);
+	}
+	fprintf(out, "# HELP mmake_spawn_latency_seconds Time taken to start a command.\n");
+	fprintf(out, "# TYPE mmake_spawn_latency_seconds summary\n");
+	fprintf(out, "mmake_spawn_latency_seconds_sum %.6f\n", values[METRIC_SPAWN_US] / 1e6);
+	fprintf(out, "mmake_spawn_latency_seconds_count %" PRId64 "\n", values[METRIC_SPAWNS]);
+	return ferror(out) ? 1 : 0;
+}
+
+void metrics_status(metrics *m, char *buf, size_t size) {
+	int64_t values[METRIC_COUNT];
+	metrics_read(m, values);
+
+	int64_t lookups = values[METRIC_STAT_HITS] + values[METRIC_STAT_MISSES];
+	double hit_rate = lookups > 0 ? 100.0 * values[METRIC_STAT_HITS] / lookups : 0.0;
+	double spawn_ms = values[METRIC_SPAWNS] > 0 ? values[METRIC_SPAWN_US] / 1e3 / values[METRIC_SPAWNS] : 0.0;
+	int len = snprintf(buf, size, "[%" PRId64 "/%" PRId64 "] %" PRId64 " running, %" PRId64 " queued",
+		values[METRIC_TARGETS_DONE], values[METRIC_TARGETS_TOTAL],
+		values[METRIC_JOBS_RUNNING], values[METRIC_QUEUE_DEPTH]);
+	if(len >= 0 && (size_t)len < size && values[METRIC_TARGETS_FAILED] > 0) {
+		len += snprintf(buf + len, size - len, ", %" PRId64 " failed", values[METRIC_TARGETS_FAILED]);
+	}
+	if(len >= 0 && (size_t)len < size) {
+		snprintf(buf + len, size - len, ", stat hits %.1f%%, spawn %.2f ms", hit_rate, spawn_ms);
+	}
+}
+
+int metrics_export_start(metrics *m, const char *path, void (*tick)(void *ctx), void *ctx) {
+	if(path != NULL && (m->export_path = strdup(path)) == NULL) {
+		return 1;
+	}
+	m->tick = tick;
+	m->tick_ctx = ctx;
+	m->stop = 0;
+	if(pthread_create(&m->export_thread, NULL, export_loop, m) != 0) {
+		free(m->export_path);
+		m->export_path = NULL;
+		return 1;
+	}
+	m->exporting = 1;
+	return 0;
+}
+
+void metrics_export_stop(metrics *m) {
+	if(!m->exporting) {
+		return;
+	}
+	pthread_mutex_lock(&m->lock);
+	m->stop = 1;
+	pthread_cond_signal(&m->cond);
+	pthread_mutex_unlock(&m->lock);
+
+	pthread_join(m->export_thread, NULL);
+	m->exporting = 0;
+	free(m->export_path);
+	m->export_path = NULL;
+}
+
+void metrics_del(metrics *m) {
+	if(m == NULL) {
+		return;
+	}
+	metrics_export_stop(m);
+
+	metrics_counters *counters = m->counters;
+	while(counters != NULL) {
+		metrics_counters *next = counters->next;
+		free(counters);
+		counters = next;
+	}
+	pthread_mutex_destroy(&m->lock);
+	pthread_cond_destroy(&m->cond);
+	free(m);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Main loop of the export thread. Exports the metrics and calls the tick
+ * function every EXPORT_INTERVAL_SEC seconds, and exports them once more
+ * when asked to stop.
+ *
+ * @param arg	The metrics.
+ * @return		NULL
+ */
+static void *export_loop(void *arg) {
+	metrics *m = arg;
+
+	for(;;) {
+		export_file(m);
+		if(m->tick != NULL) {
+			m->tick(m->tick_ctx);
+		}
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += EXPORT_INTERVAL_SEC;
+		pthread_mutex_lock(&m->lock);
+		while(!m->stop && pthread_cond_timedwait(&m->cond, &m->lock, &deadline) == 0) {
+			;
+		}
+		int stop = m->stop;
+		pthread_mutex_unlock(&m->lock);
+
+		if(stop) {
+			export_file(m);
+			return NULL;
+		}
+	}
+}
+
+/**
+ * Replaces the export file with the current metrics, through a temporary
+ * file that is renamed into place. The old file is kept if anything fails.
+ * Does nothing if there is no export file.
+ *
+ * @param m	The metrics.
+ */
+static void export_file(metrics *m) {
+	if(m->export_path == NULL) {
+		return;
+	}
+	char tmp_path[strlen(m->export_path) + 8];
+	snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", m->export_path);
+	int fd = mkstemp(tmp_path);
+	if(fd == -1) {
+		return;
+	}
+	FILE *fp = fdopen(fd, "w");
+	if(fp == NULL) {
+		close(fd);
+		unlink(tmp_path);
+		return;
+	}
+
+	// mkstemp creates the file readable by its owner only
+	fchmod(fd, 0644);
+	int failed = metrics_write(m, fp);
+	if(fclose(fp) == EOF || failed || rename(tmp_path, m->export_path) == -1) {
+		unlink(tmp_path);
+	}
+}
@@ -0,0 +1,142 @@
+/**
+ * metrics.h - Counters describing the progress of builds.
+ *
+ * Every thread that counts something gets a block of counters of its own,
+ * which only that thread writes, so counting is a plain load and store
+ * without locks or read-modify-write instructions. Readers merge the
+ * blocks by summing them; a reading thread may run alongside the counting
+ * ones. Gauges such as the number of running jobs are counted the same
+ * way, going up and down in the block of the thread that changes them.
+ *
+ * The merged values can be formatted as a one-line status, or exported in
+ * the Prometheus text format to a file that is rewritten every second by
+ * a thread of its own, for a collector to scrape. The same thread can call
+ * a function on every tick, such as one redrawing a status line:
+ *
+ *      mmake_targets_done_total 120
+ *      mmake_jobs_running 1
+ *
+ * Functions:
+ *  - metrics_new(): Creates a set of metrics with no counters.
+ *  - metrics_counters_new(): Adds a block of counters for one thread.
+ *  - metrics_add(): Adds to a counter in a block.
+ *  - metrics_read(): Reads every metric, merged over all blocks.
+ *  - metrics_write(): Writes every metric in the Prometheus text format.
+ *  - metrics_status(): Formats the metrics as a one-line status.
+ *  - metrics_export_start(): Starts exporting the metrics every second.
+ *  - metrics_export_stop(): Stops exporting, after a final export.
+ *  - metrics_del(): Frees a set of metrics and its counters.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-11-01
+ * @Version:	1.0
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* The metrics, as indices into the values read by metrics_read. */
+#define METRIC_TARGETS_TOTAL 0		/* Targets reachable from the goals of builds. */
+#define METRIC_TARGETS_DONE 1		/* Targets found up to date, built or restored. */
+#define METRIC_TARGETS_FAILED 2		/* Targets that timed out or depend on one that did. */
+#define METRIC_JOBS_RUNNING 3		/* Commands currently running (gauge). */
+#define METRIC_QUEUE_DEPTH 4		/* Targets waiting in batches (gauge). */
+#define METRIC_COMMANDS 5			/* Commands run. */
+#define METRIC_STAT_HITS 6			/* Stats answered by the stat cache. */
+#define METRIC_STAT_MISSES 7		/* Stats that went to the file system. */
+#define METRIC_SPAWNS 8				/* Commands whose spawn latency was measured. */
+#define METRIC_SPAWN_US 9			/* Total spawn latency in microseconds. */
+#define METRIC_COUNT 10
+
+typedef struct metrics metrics;
+typedef struct metrics_counters metrics_counters;
+
+/**
+ * Creates a set of metrics with no counters. The caller is responsible
+ * for freeing it with metrics_del.
+ *
+ * @return	The metrics, or NULL if out of memory.
+ */
+metrics *metrics_new(void);
+
+/**
+ * Adds a block of counters, all zero, to be written by one thread only.
+ * The block is owned by the metrics. May be called from any thread.
+ *
+ * @param m	The metrics.
+ * @return	The block, or NULL if out of memory.
+ */
+metrics_counters *metrics_counters_new(metrics *m);
+
+/**
+ * Adds to a counter in a block. Must only be called by the thread the
+ * block belongs to.
+ *
+ * @param counters	The block, or NULL to count nothing.
+ * @param metric	The metric, one of METRIC_*.
+ * @param n			The amount to add, negative to decrease a gauge.
+ */
+void metrics_add(metrics_counters *counters, int metric, int64_t n);
+
+/**
+ * Reads every metric, summed over all blocks. May be called from any
+ * thread; values counted concurrently may or may not be included.
+ *
+ * @param m			The metrics.
+ * @param values	Filled with the value of each metric, by index.
+ */
+void metrics_read(metrics *m, int64_t values[METRIC_COUNT]);
+
+/**
+ * Writes every metric in the Prometheus text exposition format.
+ *
+ * @param m		The metrics.
+ * @param out	Where to write the metrics.
+ * @return		0 on success, 1 on a write error.
+ */
+int metrics_write(metrics *m, FILE *out);
+
+/**
+ * Formats the metrics as a one-line status, such as
+ * "[12/40] 1 running, 0 queued, stat hits 93.1%, spawn 0.41 ms".
+ *
+ * @param m		The metrics.
+ * @param buf	Filled with the NUL-terminated status, truncated if needed.
+ * @param size	Size of buf in bytes.
+ */
+void metrics_status(metrics *m, char *buf, size_t size);
+
+/**
+ * Starts a thread that, every second, exports the metrics to a file and
+ * calls a function. The file is replaced atomically, so a reader never
+ * sees it half written.
+ *
+ * @param m		The metrics.
+ * @param path	Path of the file, or NULL to export none. It is copied.
+ * @param tick	Function called on every tick, from the thread, or NULL.
+ * @param ctx	Passed as the argument of tick.
+ * @return		0 on success, 1 if the thread could not be started.
+ */
+int metrics_export_start(metrics *m, const char *path, void (*tick)(void *ctx), void *ctx);
+
+/**
+ * Stops exporting the metrics, after exporting them one last time. Does
+ * nothing if they are not being exported.
+ *
+ * @param m	The metrics.
+ */
+void metrics_export_stop(metrics *m);
+
+/**
+ * Frees a set of metrics and all its blocks of counters, stopping the
+ * export if needed.
+ *
+ * @param m	The metrics, or NULL.
+ */
+void metrics_del(metrics *m);
+
+#endif
@@ -7,12 +7,40 @@
  * custom makefiles.
  * 
  * Synopsis:
- *      ./mmake [-f MAKEFILE] [-B] [-s] [TARGET...]
+ *      ./mmake [-f MAKEFILE] [-B] [-s] [-c] [-a DIR] [-w WORKERS] [-t SECONDS]
+ *              [--metrics FILE] [TARGET...]
+ *      ./mmake [-f MAKEFILE] [-c] --affected FILE...
  *
  * Options:
  *      -f [MAKEFILE]	: Use a custom makefile instead of the default "mmakefile".
  *      -B				: Force rebuild all targets, regardless of timestamps.
  *      -s				: Silence command output to stdout.
+ *      -c				: Use a pre-compiled binary image of the makefile (MAKEFILE.mmc),
+ *						  written on the first run and reused while the makefile is unchanged.
+ *      -a [DIR]		: Restore unchanged outputs from, and store new outputs in, the
+ *						  artifact cache directory DIR instead of always rebuilding them.
+ *      -w [WORKERS]	: Run commands through a pool of WORKERS worker processes reached
+ *						  over Unix sockets, instead of forking them directly (at most 1024).
+ *      -t [SECONDS]	: Kill any command still running after SECONDS. Its target fails,
+ *						  but targets not depending on it are still built.
+ *      --metrics FILE	: Export the progress of the build to FILE every second, in the
+ *						  Prometheus text format.
+ *      --affected		: Build nothing; instead print, in build order, every target that
+ *						  depends directly or transitively on one of the FILEs.
+ *
+ * When stdout is a terminal, a status line below the commands shows the
+ * progress of the build: targets done out of those to check, commands
+ * running, targets queued in batches, the stat cache hit rate and the
+ * average time taken to start a command.
+ *
+ * Rules whose targets are listed under the special target .BATCH are built
+ * together: their stale targets are collected and built with one command.
+ * Rules whose targets are listed under .DEPFILE write a gcc-style depfile
+ * (TARGET with extension .d); the prerequisites found in it are kept in
+ * .mmake_deps and checked by later builds. Rules whose targets are listed
+ * under .TIMEOUT, after a number of seconds, are killed after that long:
+ *
+ *      .TIMEOUT: 60 test_net test_db
  *
  * Targets:
  *      One or more specific targets to build. If no targets are provided,
@@ -25,16 +53,61 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
-#include "parser.h"
-#include "target.h"
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "libmmake.h"
 
 #define FALSE 0;
 #define TRUE 1;
 
+/* Values returned by getopt_long for --affected and --metrics. */
+#define OPT_AFFECTED 256
+#define OPT_METRICS 257
+
+/* Most worker processes -w may start. */
+#define MAX_WORKERS 1024
+
+/* Longest status line, and its width if the terminal's is unknown. */
+#define MAX_STATUS 256
+#define DEFAULT_WIDTH 80
+
+/* ------------------------------ Structures ------------------------------- */
+
+/*
+ * What the progress callbacks print, and the status line they keep at the
+ * bottom of the terminal. The status line is also redrawn every second by
+ * the engine's metrics thread, so printing is done under the lock.
+ */
+struct console {
+	pthread_mutex_t lock;
+	mmake *engine;
+	int silent;
+	int status;
+	int status_shown;
+	size_t width;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void print_command(void *ctx, const char *target, char **argv);
+static void print_output(void *ctx, const char *log, size_t len);
+static void print_restored(void *ctx, const char *target);
+static void print_error(void *ctx, const char *target, const char *message);
+static void print_status(void *ctx, const char *target);
+static void tick_status(void *ctx);
+static void draw_status(struct console *console);
+static void clear_status(struct console *console);
+static size_t terminal_width(void);
+static int parse_number(const char *arg, long max, int *value);
+static void usage(const char *prog, const char *message, const char *arg);
+
 /* -------------------------- External functions -------------------------- */
 
 /**
@@ -46,25 +119,53 @@
  * @return		0 on success, non-zero on error
  */
 int main(int argc, char **argv) {
-    FILE *fp;
-    int silence_commands = FALSE;
-    int force_build = FALSE;
-    makefile *mmakefile;
+    mmake_config config = {0};
+    build_progress progress = {0};
+    struct console console = { .lock = PTHREAD_MUTEX_INITIALIZER };
+    int affected_query = FALSE;
+    mmake *engine;
 	char *filename = "mmakefile";
-    const char *defaultTarget;
 	int opt;
 
+	static const struct option long_opts[] = {
+		{"affected", no_argument, NULL, OPT_AFFECTED},
+		{"metrics", required_argument, NULL, OPT_METRICS},
+		{NULL, 0, NULL, 0}
+	};
+
 	// Parse commandline options
-    while((opt = getopt(argc, argv, "f:Bs")) != -1) {
+    while((opt = getopt_long(argc, argv, "f:Bsca:w:t:", long_opts, NULL)) != -1) {
         switch (opt) {
             case 'f':
 				filename = optarg;
                 break;
             case 'B':
-                force_build = TRUE;
+                config.force_build = TRUE;
                 break;
             case 's':
-                silence_commands = TRUE;
+                console.silent = TRUE;
+                break;
+            case 'c':
+                config.use_cache = TRUE;
+                break;
+            case 'a':
+                config.artifact_dir = optarg;
+                break;
+            case 'w':
+                if(parse_number(optarg, MAX_WORKERS, &config.n_workers) == 1) {
+                    usage(argv[0], "-w expects a number of workers from 0 to 1024", optarg);
+                }
+                break;
+            case 't':
+                if(parse_number(optarg, INT_MAX, &config.timeout) == 1) {
+                    usage(argv[0], "-t expects a number of seconds, or 0 for no limit", optarg);
+                }
+                break;
+            case OPT_AFFECTED:
+                affected_query = TRUE;
+                break;
+            case OPT_METRICS:
+                config.metrics_path = optarg;
                 break;
             case '?':
                 printf("Unknown flag..\n");
@@ -75,43 +176,230 @@ int main(int argc, char **argv) {
         }
     }
 
-	// Open a specified makefile, or open default
-	fp = fopen(filename, "r");
-	if(fp == NULL) {
-		fprintf(stderr, "No such file or directory\n");
+	// Commands and their output are printed unless silenced, errors always,
+	// and on a terminal the status line follows them
+	const char *term = getenv("TERM");
+	console.status = !affected_query && isatty(STDOUT_FILENO) && term != NULL && strcmp(term, "dumb") != 0;
+	console.width = terminal_width();
+	config.metrics = console.status;
+	progress.command = print_command;
+	progress.restored = print_restored;
+	progress.output = print_output;
+	progress.error = print_error;
+	progress.finished = print_status;
+	progress.tick = tick_status;
+	progress.ctx = &console;
+	config.progress = &progress;
+
+	// Open and parse a specified makefile, or the default
+	if((engine = mmake_load(filename, &config)) == NULL) {
 		exit(EXIT_FAILURE);
 	}
+	console.engine = engine;
 
-	// Parse makefile
-	if((mmakefile = parse_makefile(fp)) == NULL) {
-		fprintf(stderr, "%s: Could not parse makefile\n", filename);
-		fclose(fp);
+	// Answer an affected-targets query, or build the specified targets or
+	// the default target
+	int result;
+	if(affected_query) {
+		result = mmake_affected(engine, argv + optind, argc - optind, stdout);
+	} else {
+		result = mmake_build(engine, (const char **)argv + optind, argc - optind);
+		clear_status(&console);
+	}
+
+	// Cleanup and exit
+	mmake_free(engine);
+	if(result == 1) {
 		exit(EXIT_FAILURE);
-	} 
-
-	// Handle specified target, or default target
-	int target_specified = FALSE;
-	for(int i = optind; i < argc ; i++) {
-		target_specified = TRUE;
-		if(handle_target(argv[i], mmakefile, force_build, silence_commands, fp) == 1) {
-			makefile_del(mmakefile);
-			fclose(fp);
-			exit(EXIT_FAILURE);
-		}
 	}
+    return 0;
+}
+
+/* -------------------------- Internal functions -------------------------- */
 
-	// If no specified targets, build the default target
-	if(!target_specified) {
-		defaultTarget = makefile_default_target(mmakefile);
-		if(handle_target(defaultTarget, mmakefile, force_build, silence_commands, fp) == 1) {
-			makefile_del(mmakefile);
-			fclose(fp);
-			exit(EXIT_FAILURE);
+/**
+ * Prints a command before it runs, unless commands are silenced. The
+ * status line is cleared, since the command may print itself.
+ *
+ * @param ctx		The console.
+ * @param target	The target built by the command (unused).
+ * @param argv		The command and its arguments.
+ */
+static void print_command(void *ctx, const char *target, char **argv) {
+	struct console *console = ctx;
+	(void)target;
+	pthread_mutex_lock(&console->lock);
+	clear_status(console);
+	if(!console->silent) {
+		int index = 0;
+		while(argv[index] != NULL) {
+			printf("%s", argv[index]);
+			if(argv[index + 1] != NULL) {
+				printf(" ");
+			}
+			index++;
 		}
-    }
+		printf("\n");
+	}
+	pthread_mutex_unlock(&console->lock);
+}
 
-	// Cleanup and exit successfully
-	makefile_del(mmakefile);
-	fclose(fp);
-    return 0;
+/**
+ * Relays output of a command captured by the executor.
+ *
+ * @param ctx	The console.
+ * @param log	The captured output.
+ * @param len	Length of log in bytes.
+ */
+static void print_output(void *ctx, const char *log, size_t len) {
+	struct console *console = ctx;
+	pthread_mutex_lock(&console->lock);
+	clear_status(console);
+	fwrite(log, 1, len, stdout);
+	pthread_mutex_unlock(&console->lock);
+}
+
+/**
+ * Prints that a target was restored from the artifact cache, unless
+ * commands are silenced.
+ *
+ * @param ctx		The console.
+ * @param target	The restored target.
+ */
+static void print_restored(void *ctx, const char *target) {
+	struct console *console = ctx;
+	if(console->silent) {
+		return;
+	}
+	pthread_mutex_lock(&console->lock);
+	clear_status(console);
+	printf("%s: restored from artifact cache\n", target);
+	pthread_mutex_unlock(&console->lock);
+}
+
+/**
+ * Prints an error to stderr.
+ *
+ * @param ctx		The console.
+ * @param target	The file or target concerned, or NULL.
+ * @param message	Description of the error.
+ */
+static void print_error(void *ctx, const char *target, const char *message) {
+	struct console *console = ctx;
+	pthread_mutex_lock(&console->lock);
+	clear_status(console);
+	if(target != NULL) {
+		fprintf(stderr, "%s: %s\n", target, message);
+	} else {
+		fprintf(stderr, "%s\n", message);
+	}
+	pthread_mutex_unlock(&console->lock);
+}
+
+/**
+ * Draws the status line after a command has run.
+ *
+ * @param ctx		The console.
+ * @param target	The target built by the command (unused).
+ */
+static void print_status(void *ctx, const char *target) {
+	struct console *console = ctx;
+	(void)target;
+	pthread_mutex_lock(&console->lock);
+	draw_status(console);
+	pthread_mutex_unlock(&console->lock);
+}
+
+/**
+ * Redraws the status line every second, from the engine's metrics thread,
+ * so that it keeps moving while a long command runs.
+ *
+ * @param ctx	The console.
+ */
+static void tick_status(void *ctx) {
+	struct console *console = ctx;
+	pthread_mutex_lock(&console->lock);
+	draw_status(console);
+	pthread_mutex_unlock(&console->lock);
+}
+
+/**
+ * Draws the status line, if stdout is a terminal. It is left without a
+ * newline, so the next line printed replaces it. The caller holds the
+ * console's lock.
+ *
+ * @param console	The console.
+ */
+static void draw_status(struct console *console) {
+	metrics *m = console->engine != NULL ? mmake_metrics(console->engine) : NULL;
+	char line[MAX_STATUS];
+	if(!console->status || m == NULL) {
+		return;
+	}
+	metrics_status(m, line, console->width < sizeof line ? console->width : sizeof line);
+	printf("\r\033[K%s", line);
+	fflush(stdout);
+	console->status_shown = TRUE;
+}
+
+/**
+ * Clears the status line, if one is drawn, so that something else can be
+ * printed in its place. The caller holds the console's lock, unless no
+ * build is running.
+ *
+ * @param console	The console.
+ */
+static void clear_status(struct console *console) {
+	if(console->status_shown) {
+		printf("\r\033[K");
+		console->status_shown = FALSE;
+	}
+}
+
+/**
+ * Determines the width of the terminal on stdout, so that the status line
+ * fits on one row.
+ *
+ * @return	The width in columns, or DEFAULT_WIDTH if not known.
+ */
+static size_t terminal_width(void) {
+	struct winsize size;
+	if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1 || size.ws_col == 0) {
+		return DEFAULT_WIDTH;
+	}
+	return size.ws_col;
+}
+
+/**
+ * Parses a whole non-negative decimal number given as an option argument.
+ *
+ * @param arg	The argument.
+ * @param max	The largest value accepted.
+ * @param value	Filled with the number on success.
+ * @return		0 on success, 1 if arg is not such a number or is too large.
+ */
+static int parse_number(const char *arg, long max, int *value) {
+	char *end;
+	errno = 0;
+	long number = strtol(arg, &end, 10);
+	if(end == arg || *end != '\0' || errno == ERANGE || number < 0 || number > max) {
+		return 1;
+	}
+	*value = (int)number;
+	return 0;
+}
+
+/**
+ * Prints what is wrong with an option argument, followed by the synopsis,
+ * and exits.
+ *
+ * @param prog		Name of the program.
+ * @param message	What the option expects.
+ * @param arg		The rejected argument.
+ */
+static void usage(const char *prog, const char *message, const char *arg) {
+	fprintf(stderr, "%s: %s, not \"%s\"\n", prog, message, arg);
+	fprintf(stderr, "Usage: %s [-f MAKEFILE] [-B] [-s] [-c] [-a DIR] [-w WORKERS] [-t SECONDS]\n"
+		"       [--metrics FILE] [TARGET...]\n", prog);
+	exit(EXIT_FAILURE);
 }
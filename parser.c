@@ -15,20 +15,26 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/mman.h>
 #include "parser.h"
+#include "strmap.h"
 
 
 /* ------------------------------- Constants ------------------------------- */
 
 #define MAX_RULES 256
 #define MAX_LINE 1024
-#define MAX_PREREQ 32
 #define MAX_CMD 32
 
 /* ------------------------------ Structures ------------------------------- */
 
 struct makefile {
 	struct rule *rules;
+	struct rule *tail;
+	size_t n_rules;
+	strmap *index;
+	void *image;
+	size_t image_len;
 };
 
 struct rule {
@@ -36,6 +42,7 @@ struct rule {
 	char **prereq;
 	char **cmd;
 	rule *next;
+	size_t index;
 };
 
 
@@ -45,8 +52,12 @@ static rule *parse_rule(FILE *fp, bool *err);
 static char *extract_target(char **p, char *buf, FILE *fp, bool *err);
 static char *parse_prereqs(char **p, char **prereq, size_t *n_prereq);
 static char *advance_until_cmd(char *buf, FILE *fp);
+static bool has_cmd(FILE *fp);
 static size_t parse_cmd(char **cmd, char **p);
+static rule *build_rule(char *target, char **prereq, size_t n_prereq, 
+                        char **cmd, size_t n_words, bool *err);
 static rule *create_rule(char *target, char **prereq, char **cmd);
+static int append_rule(makefile *m, rule *r);
 static char **dupe_str_array(size_t n, char **a);
 static char *next_line(char buf[MAX_LINE], FILE *fp);
 static char *parse_word(char **p, char *delim);
@@ -54,7 +65,7 @@ static void skipwhite(char **p);
 static bool expect(char **p, char c);
 static bool is_blank_line(const char *s);
 static void free_arr(char **arr);
-static void del_rules(struct rule *rules);
+static void del_rules(struct rule *rules, bool owns_strings);
 static void err0(bool *err);
 static void err1(char *target, bool *err);
 static void err2(char *prereq[], size_t n_prereq, char *target, bool *err);
@@ -64,14 +75,20 @@ static void err2(char *prereq[], size_t n_prereq, char *target, bool *err);
 
 makefile *parse_makefile(FILE *fp)
 {
-	makefile *m = malloc(sizeof *m);
-	rule **tailp = &m->rules;
+	makefile *m = makefile_new(NULL, 0);
+	if (m == NULL) {
+		return NULL;
+	}
 
 	bool err = false;
-	while ((*tailp = parse_rule(fp, &err)) != NULL) {
-		tailp = &(*tailp)->next;
+	rule *r;
+	while ((r = parse_rule(fp, &err)) != NULL) {
+		if (append_rule(m, r) != 0) {
+			del_rules(r, true);
+			err = true;
+			break;
+		}
 	}
-	*tailp = NULL;
 
 	if (m->rules == NULL || err) {
 		makefile_del(m);
@@ -84,21 +101,20 @@ makefile *parse_makefile(FILE *fp)
 
 const char *makefile_default_target(makefile *m)
 {
+	// special targets such as .BATCH are never the default
+	for (rule *r = m->rules; r != NULL; r = r->next) {
+		if (r->target[0] != '.') {
+			return r->target;
+		}
+	}
+
 	return m->rules->target;
 }
 
 
 rule *makefile_rule(makefile *m, const char *target)
 {
-	rule *i = m->rules;
-	while (i != NULL){
-		if (strcmp(i->target, target) == 0) {
-			return i;
-		}
-		i = i->next;
-	}
-
-	return NULL;
+	return strmap_get(m->index, target);
 }
 
 
@@ -116,11 +132,95 @@ char **rule_cmd(rule *rule)
 
 void makefile_del(makefile *make)
 {
-	del_rules(make->rules);
+	del_rules(make->rules, make->image == NULL);
+	strmap_del(make->index);
+	if (make->image != NULL) {
+		munmap(make->image, make->image_len);
+	}
 	free(make);
 }
 
 
+makefile *makefile_new(void *image, size_t image_len)
+{
+	makefile *m = malloc(sizeof *m);
+	if (m == NULL) {
+		return NULL;
+	}
+
+	// image-backed makefiles get their index with makefile_set_index
+	m->index = NULL;
+	if (image == NULL && (m->index = strmap_new()) == NULL) {
+		free(m);
+		return NULL;
+	}
+	m->rules = NULL;
+	m->tail = NULL;
+	m->n_rules = 0;
+	m->image = image;
+	m->image_len = image_len;
+
+	return m;
+}
+
+
+int makefile_add_rule(makefile *make, char *target, char **prereq, char **cmd)
+{
+	rule *r = create_rule(target, prereq, cmd);
+	if (r == NULL || append_rule(make, r) != 0) {
+		// the makefile owned the strings, so they go with the rule
+		if (make->image == NULL) {
+			free(target);
+			free_arr(prereq);
+			free(prereq);
+			free_arr(cmd);
+			free(cmd);
+		}
+		free(r);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+void makefile_set_index(makefile *make, strmap *index)
+{
+	strmap_del(make->index);
+	make->index = index;
+}
+
+
+rule *makefile_first_rule(makefile *make)
+{
+	return make->rules;
+}
+
+
+rule *rule_next(rule *rule)
+{
+	return rule->next;
+}
+
+
+const char *rule_target(rule *rule)
+{
+	return rule->target;
+}
+
+
+size_t rule_index(rule *rule)
+{
+	return rule->index;
+}
+
+
+size_t makefile_rule_count(makefile *make)
+{
+	return make->n_rules;
+}
+
+
 /* -------------------------- Internal functions -------------------------- */
 
 /**
@@ -153,6 +253,11 @@ static rule *parse_rule(FILE *fp, bool *err)
 		return NULL;
 	}
 
+	// special targets only annotate other rules and may lack a command
+	if (target[0] == '.' && !has_cmd(fp)) {
+		return build_rule(target, prereq, n_prereq, cmd, 0, err);
+	}
+
 	p = advance_until_cmd(buf, fp);
 	if(p == NULL)
 	{
@@ -162,8 +267,41 @@ static rule *parse_rule(FILE *fp, bool *err)
 
 	size_t n_words = parse_cmd(cmd, &p);
 
-	rule *r = create_rule(target, dupe_str_array(n_prereq, prereq), 
-	                      dupe_str_array(n_words, cmd));
+	return build_rule(target, prereq, n_prereq, cmd, n_words, err);
+}
+
+
+/**
+ * Builds a rule from the words of a parsed rule. If memory runs out the 
+ * words are freed and err is set, so that it is not taken for the end of 
+ * the file.
+ *
+ * @param target    Target of the rule.
+ * @param prereq    Array with the prerequisites.
+ * @param n_prereq  Number of prerequisites.
+ * @param cmd       Array with the command and its arguments.
+ * @param n_words   Number of words in cmd.
+ * @param err       Pointer to flag which gets set to true on error.
+ * @return          The rule, or NULL if out of memory.
+ */
+static rule *build_rule(char *target, char **prereq, size_t n_prereq, 
+                        char **cmd, size_t n_words, bool *err)
+{
+	char **prereq_arr = dupe_str_array(n_prereq, prereq);
+	char **cmd_arr = dupe_str_array(n_words, cmd);
+	rule *r = NULL;
+	if (prereq_arr != NULL && cmd_arr != NULL) {
+		r = create_rule(target, prereq_arr, cmd_arr);
+	}
+
+	if (r == NULL) {
+		free(prereq_arr);
+		free(cmd_arr);
+		for (size_t i = 0; i < n_words; i++) {
+			free(cmd[i]);
+		}
+		err2(prereq, n_prereq, target, err);
+	}
 
 	return r;
 }
@@ -264,6 +402,28 @@ static char *advance_until_cmd(char *buf, FILE *fp)
 }
 
 
+/**
+ * Check, without consuming it, whether the next non-empty line in fp is a 
+ * command, i.e. begins with tab.
+ * 
+ * @param fp    File pointer to the file that should be red.
+ * @return      True if a command follows, false otherwise.
+*/
+static bool has_cmd(FILE *fp)
+{
+	int c;
+	while ((c = getc(fp)) == '\n') {
+	}
+
+	if (c == EOF) {
+		return false;
+	}
+	ungetc(c, fp);
+
+	return c == '\t';
+}
+
+
 /**
  * Parse a command and insert words into **cmd.
  * 
@@ -295,24 +455,60 @@ static size_t parse_cmd(char **cmd, char **p)
 static rule *create_rule(char *target, char **prereq, char **cmd)
 {
 	rule *r = malloc(sizeof *r);
+	if (r == NULL) {
+		return NULL;
+	}
 	r->target = target;
 	r->prereq = prereq;
 	r->cmd = cmd;
+	r->next = NULL;
 
 	return r;
 }
 
 
+/**
+ * Appends a rule to the end of a makefile and indexes it by target, unless 
+ * the makefile is given its index later. If several rules share a target, 
+ * lookups keep returning the first one.
+ * 
+ * @param m		The makefile to append to.
+ * @param r		The rule to append.
+ * @return		0 on success, 1 if out of memory.
+*/
+static int append_rule(makefile *m, rule *r)
+{
+	if (m->index != NULL && strmap_get(m->index, r->target) == NULL
+			&& strmap_put(m->index, r->target, r) != 0) {
+		return 1;
+	}
+
+	if (m->tail == NULL) {
+		m->rules = r;
+	} else {
+		m->tail->next = r;
+	}
+	m->tail = r;
+	r->index = m->n_rules++;
+
+	return 0;
+}
+
+
 /**
  * Duplicate an array of strings.
  *
  * @param n     Size of array to duplicate.
  * @param a     Array to duplicate.
- * @return      NULL-terminated array which should be freed using free.
+ * @return      NULL-terminated array which should be freed using free, or 
+ *              NULL if out of memory.
  */
 static char **dupe_str_array(size_t n, char **a)
 {
 	char **ret = malloc((n + 1) * sizeof *ret);
+	if (ret == NULL) {
+		return NULL;
+	}
 
 	for (size_t i = 0; i < n; i++) {
 		ret[i] = a[i];
@@ -436,27 +632,31 @@ static void free_arr(char **arr)
 }
 
 /**
- * Recursively delete a list of rules.
+ * Delete a list of rules. Done iteratively so that makefiles with a very
+ * large number of rules do not exhaust the stack.
  * 
- * @param rules   The rules to delete.
+ * @param rules          The rules to delete.
+ * @param owns_strings   False if the strings and arrays of the rules live in
+ *                       a mapped image and must not be freed.
  */
-static void del_rules(struct rule *rules) 
+static void del_rules(struct rule *rules, bool owns_strings) 
 {
-	if (rules == NULL) {
-		return;
-	}
+	while (rules != NULL) {
+		struct rule *next = rules->next;
 
-	free(rules->target);
+		if (owns_strings) {
+			free(rules->target);
 
-	free_arr(rules->prereq);	
-	free(rules->prereq);
+			free_arr(rules->prereq);	
+			free(rules->prereq);
 
-	free_arr(rules->cmd);
-	free(rules->cmd);
-
-	del_rules(rules->next);
+			free_arr(rules->cmd);
+			free(rules->cmd);
+		}
 
-	free(rules);
+		free(rules);
+		rules = next;
+	}
 }
 
 
@@ -14,6 +14,10 @@
 #define PARSER_H
 
 #include <stdio.h>
+#include "strmap.h"
+
+/* The largest number of prerequisites a rule may have. */
+#define MAX_PREREQ 32
 
 typedef struct makefile makefile;
 typedef struct rule rule;
@@ -21,7 +25,8 @@ typedef struct rule rule;
 
 /**
  * Parse a makefile. The function allocates memory for a structure of the type 
- * makefile. The structure will contain all the rules in the makefile. If there
+ * makefile. The structure will contain all the rules in the makefile. Special 
+ * targets, whose names begin with '.', may be given without a command. If there
  * is no rule in the makefile then the function returns NULL and no memory for 
  * the structure is allocated. The caller of this function is responsible to 
  * deallocate the memory by using the function makefile_del.
@@ -34,7 +39,8 @@ makefile *parse_makefile(FILE *fp);
 
 /**
  * Returns a pointer to the name of the default target for a makefile. (The 
- * default target is the target for the first rule.)
+ * default target is the target for the first rule, skipping special targets 
+ * whose names begin with '.'.)
  *
  * @param make  A pointer to a structue of type makefile.
  * @return      A pointer to the name of the default target for a makefile.
@@ -83,4 +89,93 @@ char **rule_cmd(rule *rule);
  */
 void makefile_del(makefile *make);
 
+
+/**
+ * Create an empty makefile to which rules can be added with 
+ * makefile_add_rule. If image is not NULL, the strings and arrays of all 
+ * rules added are assumed to live inside that memory mapping; makefile_del 
+ * will then unmap it instead of freeing them one by one. Such a makefile 
+ * has no index of its rules by target until one is given with 
+ * makefile_set_index, so makefile_rule must not be used before.
+ *
+ * @param image      A mapping owned by the makefile, or NULL.
+ * @param image_len  The length of the mapping in bytes.
+ * @return           A pointer to the new makefile, or NULL if out of memory.
+ */
+makefile *makefile_new(void *image, size_t image_len);
+
+
+/**
+ * Append a rule to a makefile. The makefile takes ownership of target, 
+ * prereq and cmd (see makefile_new for makefiles backed by an image), even 
+ * when the rule cannot be added, in which case they are freed. Both 
+ * arrays must be terminated with NULL.
+ *
+ * @param make    A pointer to the makefile.
+ * @param target  The name of the target.
+ * @param prereq  The prerequisites of the rule.
+ * @param cmd     The command, and its arguments, used to build the rule.
+ * @return        0 on success, 1 if out of memory.
+ */
+int makefile_add_rule(makefile *make, char *target, char **prereq, char **cmd);
+
+
+/**
+ * Give a makefile backed by an image its index of rules by target, once 
+ * all rules are added. The index maps each target to the first of its 
+ * rules, and is freed with the makefile.
+ *
+ * @param make   A pointer to the makefile.
+ * @param index  The index.
+ */
+void makefile_set_index(makefile *make, strmap *index);
+
+
+/**
+ * Returns a pointer to the first rule of a makefile, in file order.
+ *
+ * @param make  A pointer to a structue of type makefile.
+ * @return      A pointer to the first rule, or NULL if there are none.
+ */
+rule *makefile_first_rule(makefile *make);
+
+
+/**
+ * Returns a pointer to the rule following a rule, in file order.
+ *
+ * @param rule  A pointer to the rule.
+ * @return      A pointer to the next rule, or NULL if it is the last one.
+ */
+rule *rule_next(rule *rule);
+
+
+/**
+ * Returns a pointer to the name of the target of a rule.
+ *
+ * @param rule  A pointer to the rule.
+ * @return      A pointer to the name of the target.
+ */
+const char *rule_target(rule *rule);
+
+
+/**
+ * Returns the index of a rule: its position among the rules of its 
+ * makefile, counted from 0 in file order. It never changes, so callers 
+ * can keep state of their own for each rule in an array of 
+ * makefile_rule_count elements, without touching the makefile.
+ *
+ * @param rule  A pointer to the rule.
+ * @return      The index of the rule.
+ */
+size_t rule_index(rule *rule);
+
+
+/**
+ * Returns the number of rules in a makefile.
+ *
+ * @param make  A pointer to a structue of type makefile.
+ * @return      The number of rules.
+ */
+size_t makefile_rule_count(makefile *make);
+
 #endif
@@ -0,0 +1,172 @@
+/**
+ * sha256.c - SHA-256 digests, as specified in FIPS 180-4.
+ *
+ * Bytes are collected into 64-byte blocks, and each whole block is mixed
+ * into the eight state words by the compression function. The last block
+ * is padded with a 1 bit, zeros and the message length in bits.
+ *
+ * Functions:
+ *  - sha256_init(): Starts a new digest.
+ *  - sha256_update(): Feeds a block of bytes into a digest.
+ *  - sha256_final(): Finishes a digest.
+ *  - sha256_file(): Computes the digest of the contents of a file.
+ *  - compress(): Mixes one block into the state of a digest.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-11-02
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sha256.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define READ_CHUNK 65536
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Round constants: the first 32 bits of the fractional parts of the cube
+ * roots of the first 64 primes. */
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void compress(uint32_t state[8], const unsigned char block[64]);
+
+/* -------------------------- External functions -------------------------- */
+
+void sha256_init(sha256_ctx *ctx) {
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memcpy(ctx->state, initial, sizeof initial);
+	ctx->n_block = 0;
+	ctx->len = 0;
+}
+
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len) {
+	const unsigned char *p = data;
+	ctx->len += len;
+
+	// Top up a partial block first, then compress whole blocks in place
+	if(ctx->n_block > 0) {
+		size_t n = sizeof ctx->block - ctx->n_block < len ? sizeof ctx->block - ctx->n_block : len;
+		memcpy(ctx->block + ctx->n_block, p, n);
+		ctx->n_block += n;
+		p += n;
+		len -= n;
+		if(ctx->n_block < sizeof ctx->block) {
+			return;
+		}
+		compress(ctx->state, ctx->block);
+		ctx->n_block = 0;
+	}
+	while(len >= sizeof ctx->block) {
+		compress(ctx->state, p);
+		p += sizeof ctx->block;
+		len -= sizeof ctx->block;
+	}
+	memcpy(ctx->block, p, len);
+	ctx->n_block = len;
+}
+
+void sha256_final(sha256_ctx *ctx, unsigned char digest[SHA256_LEN]) {
+	uint64_t bits = ctx->len * 8;
+
+	ctx->block[ctx->n_block++] = 0x80;
+	if(ctx->n_block > sizeof ctx->block - 8) {
+		memset(ctx->block + ctx->n_block, 0, sizeof ctx->block - ctx->n_block);
+		compress(ctx->state, ctx->block);
+		ctx->n_block = 0;
+	}
+	memset(ctx->block + ctx->n_block, 0, sizeof ctx->block - 8 - ctx->n_block);
+	for(int i = 0; i < 8; i++) {
+		ctx->block[sizeof ctx->block - 1 - i] = (unsigned char)(bits >> (8 * i));
+	}
+	compress(ctx->state, ctx->block);
+
+	for(int i = 0; i < 8; i++) {
+		digest[4 * i] = (unsigned char)(ctx->state[i] >> 24);
+		digest[4 * i + 1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[4 * i + 2] = (unsigned char)(ctx->state[i] >> 8);
+		digest[4 * i + 3] = (unsigned char)ctx->state[i];
+	}
+}
+
+int sha256_file(const char *path, unsigned char digest[SHA256_LEN]) {
+	unsigned char buf[READ_CHUNK];
+	size_t n;
+	sha256_ctx ctx;
+
+	FILE *fp = fopen(path, "rb");
+	if(fp == NULL) {
+		return 1;
+	}
+	sha256_init(&ctx);
+	while((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+		sha256_update(&ctx, buf, n);
+	}
+	if(ferror(fp)) {
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	sha256_final(&ctx, digest);
+	return 0;
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Mixes one 64-byte block into the state of a digest.
+ *
+ * @param state	The eight state words.
+ * @param block	The block.
+ */
+static void compress(uint32_t state[8], const unsigned char block[64]) {
+	uint32_t w[64];
+	for(int i = 0; i < 16; i++) {
+		w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16
+			| (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+	}
+	for(int i = 16; i < 64; i++) {
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for(int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
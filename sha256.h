@@ -0,0 +1,77 @@
+/**
+ * sha256.h - SHA-256 digests, as specified in FIPS 180-4.
+ *
+ * Used where a digest names content that is shared and trusted later,
+ * such as the entries of the artifact cache, so that no two different
+ * inputs can be made to collide. The caches that only detect changes use
+ * the cheaper hash in hash.h instead.
+ *
+ * Functions:
+ *  - sha256_init(): Starts a new digest.
+ *  - sha256_update(): Feeds a block of bytes into a digest.
+ *  - sha256_final(): Finishes a digest.
+ *  - sha256_file(): Computes the digest of the contents of a file.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-11-02
+ * @Version:	1.0
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Length of a digest in bytes. */
+#define SHA256_LEN 32
+
+/**
+ * The state of a digest being computed.
+ *
+ * state	The hash values of the blocks fed in so far.
+ * block	Bytes not yet making up a whole block.
+ * n_block	Number of bytes in block.
+ * len		Total number of bytes fed in.
+ */
+typedef struct sha256_ctx {
+	uint32_t state[8];
+	unsigned char block[64];
+	size_t n_block;
+	uint64_t len;
+} sha256_ctx;
+
+/**
+ * Starts a new digest.
+ *
+ * @param ctx	The state to initialise.
+ */
+void sha256_init(sha256_ctx *ctx);
+
+/**
+ * Feeds a block of bytes into a digest.
+ *
+ * @param ctx	The state of the digest.
+ * @param data	The bytes to feed in.
+ * @param len	Number of bytes in data.
+ */
+void sha256_update(sha256_ctx *ctx, const void *data, size_t len);
+
+/**
+ * Finishes a digest. The state must be initialised again before reuse.
+ *
+ * @param ctx		The state of the digest.
+ * @param digest	Filled with the digest.
+ */
+void sha256_final(sha256_ctx *ctx, unsigned char digest[SHA256_LEN]);
+
+/**
+ * Computes the digest of the full contents of a file.
+ *
+ * @param path		Path to the file.
+ * @param digest	Filled with the digest of the file contents.
+ * @return			0 on success, 1 if the file could not be read.
+ */
+int sha256_file(const char *path, unsigned char digest[SHA256_LEN]);
+
+#endif
@@ -0,0 +1,315 @@
+/**
+ * stamps.c - Content digests of prerequisites whose timestamps can't be trusted.
+ *
+ * The log starts with a magic header followed by one record per target:
+ *
+ *      n (u32) | data_len (u32) | digest (u64) * n | target \0 prereq \0 ...
+ *
+ * Only suspect prerequisites are recorded, so the log stays small; it is
+ * read whole at startup and, if anything was recorded, rewritten whole
+ * through a temporary file on close. A build that crashes loses only its
+ * own records, which at worst causes an extra rebuild.
+ *
+ * Functions:
+ *  - stamps_log_open(): Loads the recorded digests.
+ *  - stamps_log_changed(): Checks whether a prerequisite's contents changed.
+ *  - stamps_log_record(): Records the digests of a target's prerequisites.
+ *  - stamps_log_close(): Writes back the digests if needed and frees them.
+ *  - load_log(): Reads all records of an existing log.
+ *  - make_entry(): Allocates an entry holding a target and its digests.
+ *  - put_entry(): Stores an entry, replacing any older one for the target.
+ *  - write_log(): Rewrites the log file from the entries in memory.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-30
+ * @Version:	1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "stamps.h"
+#include "strmap.h"
+#include "hash.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define LOG_MAGIC "MMKSTMP1"
+#define MAGIC_LEN 8
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct stamp {
+	const char *prereq;
+	uint64_t digest;
+};
+
+struct stamps_entry {
+	size_t slot;
+	const char *target;
+	size_t n_stamps;
+	struct stamp stamps[];
+};
+
+struct stamps_log {
+	char *path;
+	strmap *entries;
+	struct stamps_entry **list;
+	size_t n_entries;
+	size_t cap;
+	int dirty;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static void load_log(stamps_log *log);
+static struct stamps_entry *make_entry(const char *target, const char **prereq, const uint64_t *digests, size_t n);
+static int put_entry(stamps_log *log, struct stamps_entry *entry);
+static void write_log(stamps_log *log);
+
+/* -------------------------- External functions -------------------------- */
+
+stamps_log *stamps_log_open(const char *path) {
+	stamps_log *log = calloc(1, sizeof *log);
+	if(log == NULL) {
+		return NULL;
+	}
+	log->path = strdup(path);
+	log->entries = strmap_new();
+	if(log->path == NULL || log->entries == NULL) {
+		stamps_log_close(log);
+		return NULL;
+	}
+	load_log(log);
+	return log;
+}
+
+int stamps_log_changed(stamps_log *log, const char *target, const char *prereq) {
+	struct stamps_entry *entry = strmap_get(log->entries, target);
+	if(entry == NULL) {
+		return 1;
+	}
+	for(size_t i = 0; i < entry->n_stamps; i++) {
+		uint64_t digest;
+		if(strcmp(entry->stamps[i].prereq, prereq) == 0) {
+			return hash_file(prereq, &digest) == 1 || digest != entry->stamps[i].digest;
+		}
+	}
+	return 1;
+}
+
+int stamps_log_record(stamps_log *log, const char *target, const char **prereq, size_t n_prereq) {
+	struct stamps_entry *old = strmap_get(log->entries, target);
+	if(n_prereq == 0 && (old == NULL || old->n_stamps == 0)) {
+		return 0;
+	}
+
+	// Digest the prerequisites that can be read, keeping them in order
+	const char **hashed = malloc((n_prereq + 1) * sizeof *hashed);
+	uint64_t *digests = malloc((n_prereq + 1) * sizeof *digests);
+	if(hashed == NULL || digests == NULL) {
+		free(hashed);
+		free(digests);
+		return 1;
+	}
+	size_t n = 0;
+	for(size_t i = 0; i < n_prereq; i++) {
+		if(hash_file(prereq[i], &digests[n]) == 0) {
+			hashed[n++] = prereq[i];
+		}
+	}
+
+	struct stamps_entry *entry = make_entry(target, hashed, digests, n);
+	free(hashed);
+	free(digests);
+	if(entry == NULL || put_entry(log, entry) == 1) {
+		free(entry);
+		return 1;
+	}
+	log->dirty = 1;
+	return 0;
+}
+
+void stamps_log_close(stamps_log *log) {
+	if(log == NULL) {
+		return;
+	}
+	if(log->dirty) {
+		write_log(log);
+	}
+	for(size_t i = 0; i < log->n_entries; i++) {
+		free(log->list[i]);
+	}
+	free(log->list);
+	strmap_del(log->entries);
+	free(log->path);
+	free(log);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Reads all records of an existing log. Reading stops at the first record
+ * that is incomplete or malformed.
+ *
+ * @param log	The stamps log.
+ */
+static void load_log(stamps_log *log) {
+	FILE *fp = fopen(log->path, "rb");
+	if(fp == NULL) {
+		return;
+	}
+
+	char magic[MAGIC_LEN];
+	if(fread(magic, 1, MAGIC_LEN, fp) != MAGIC_LEN || memcmp(magic, LOG_MAGIC, MAGIC_LEN) != 0) {
+		fclose(fp);
+		return;
+	}
+
+	uint32_t header[2];
+	while(fread(header, sizeof *header, 2, fp) == 2) {
+		uint32_t n = header[0];
+		uint32_t data_len = header[1];
+		if(data_len == 0) {
+			break;
+		}
+
+		uint64_t *digests = malloc(((size_t)n + 1) * sizeof *digests);
+		char *data = malloc(data_len);
+		const char **strs = n < data_len ? malloc(((size_t)n + 1) * sizeof *strs) : NULL;
+		struct stamps_entry *entry = NULL;
+		if(digests != NULL && data != NULL && strs != NULL
+				&& fread(digests, sizeof *digests, n, fp) == n
+				&& fread(data, 1, data_len, fp) == data_len && data[data_len - 1] == '\0') {
+			// Split the data into the target and its prerequisites
+			size_t n_strs = 0;
+			for(char *p = data; p < data + data_len && n_strs <= n; p += strlen(p) + 1) {
+				strs[n_strs++] = p;
+			}
+			if(n_strs == (size_t)n + 1) {
+				entry = make_entry(strs[0], strs + 1, digests, n);
+			}
+		}
+		free(digests);
+		free(data);
+		free(strs);
+		if(entry == NULL || put_entry(log, entry) == 1) {
+			free(entry);
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+/**
+ * Allocates an entry holding copies of a target, its prerequisites and
+ * their digests, in a single block of memory.
+ *
+ * @param target	The target.
+ * @param prereq	The prerequisites.
+ * @param digests	The digest of each prerequisite.
+ * @param n			Number of prerequisites.
+ * @return			The entry, or NULL if out of memory.
+ */
+static struct stamps_entry *make_entry(const char *target, const char **prereq, const uint64_t *digests, size_t n) {
+	size_t size = sizeof(struct stamps_entry) + n * sizeof(struct stamp) + strlen(target) + 1;
+	for(size_t i = 0; i < n; i++) {
+		size += strlen(prereq[i]) + 1;
+	}
+
+	struct stamps_entry *entry = malloc(size);
+	if(entry == NULL) {
+		return NULL;
+	}
+	char *p = (char *)&entry->stamps[n];
+	entry->target = p;
+	entry->n_stamps = n;
+	p = stpcpy(p, target) + 1;
+	for(size_t i = 0; i < n; i++) {
+		entry->stamps[i].prereq = p;
+		entry->stamps[i].digest = digests[i];
+		p = stpcpy(p, prereq[i]) + 1;
+	}
+	return entry;
+}
+
+/**
+ * Stores an entry, replacing and freeing any older entry for its target.
+ *
+ * @param log	The stamps log.
+ * @param entry	The entry, owned by the log on success.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int put_entry(stamps_log *log, struct stamps_entry *entry) {
+	struct stamps_entry *old = strmap_get(log->entries, entry->target);
+	if(old == NULL && log->n_entries == log->cap) {
+		size_t cap = log->cap != 0 ? log->cap * 2 : 64;
+		struct stamps_entry **list = realloc(log->list, cap * sizeof *list);
+		if(list == NULL) {
+			return 1;
+		}
+		log->list = list;
+		log->cap = cap;
+	}
+	if(strmap_put(log->entries, entry->target, entry) == 1) {
+		return 1;
+	}
+
+	if(old != NULL) {
+		entry->slot = old->slot;
+		free(old);
+	} else {
+		entry->slot = log->n_entries++;
+	}
+	log->list[entry->slot] = entry;
+	return 0;
+}
+
+/**
+ * Rewrites the log file with one record per target that has digests,
+ * through a temporary file that is renamed into place. The old log is
+ * kept if anything fails.
+ *
+ * @param log	The stamps log.
+ */
+static void write_log(stamps_log *log) {
+	char tmp_path[strlen(log->path) + 8];
+	snprintf(tmp_path, sizeof tmp_path, "%s.XXXXXX", log->path);
+	int fd = mkstemp(tmp_path);
+	if(fd == -1) {
+		return;
+	}
+	FILE *fp = fdopen(fd, "wb");
+	if(fp == NULL) {
+		close(fd);
+		unlink(tmp_path);
+		return;
+	}
+
+	int failed = fwrite(LOG_MAGIC, 1, MAGIC_LEN, fp) != MAGIC_LEN;
+	for(size_t i = 0; i < log->n_entries && !failed; i++) {
+		struct stamps_entry *entry = log->list[i];
+		if(entry->n_stamps == 0) {
+			continue;
+		}
+
+		uint32_t header[2] = { entry->n_stamps, strlen(entry->target) + 1 };
+		for(size_t k = 0; k < entry->n_stamps; k++) {
+			header[1] += strlen(entry->stamps[k].prereq) + 1;
+		}
+		failed = fwrite(header, sizeof *header, 2, fp) != 2;
+		for(size_t k = 0; k < entry->n_stamps && !failed; k++) {
+			failed = fwrite(&entry->stamps[k].digest, sizeof(uint64_t), 1, fp) != 1;
+		}
+		failed = failed || fwrite(entry->target, 1, strlen(entry->target) + 1, fp) == 0;
+		for(size_t k = 0; k < entry->n_stamps && !failed; k++) {
+			const char *prereq = entry->stamps[k].prereq;
+			failed = fwrite(prereq, 1, strlen(prereq) + 1, fp) != strlen(prereq) + 1;
+		}
+	}
+	if(fclose(fp) == EOF || failed || rename(tmp_path, log->path) == -1) {
+		unlink(tmp_path);
+	}
+}
@@ -0,0 +1,75 @@
+/**
+ * stamps.h - Content digests of prerequisites whose timestamps can't be trusted.
+ *
+ * Timestamps decide staleness, but not every timestamp can decide it:
+ * files on file systems that only keep whole seconds may have been
+ * changed in the same second their target was built, and files dated in
+ * the future (clock skew, archives) look newer than anything built now.
+ * For such prerequisites the digest of their contents is recorded when
+ * their target is built, and a later build compares contents instead of
+ * timestamps whenever the timestamps alone are inconclusive.
+ *
+ * Functions:
+ *  - stamps_log_open(): Loads the recorded digests.
+ *  - stamps_log_changed(): Checks whether a prerequisite's contents changed.
+ *  - stamps_log_record(): Records the digests of a target's prerequisites.
+ *  - stamps_log_close(): Writes back the digests if needed and frees them.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-30
+ * @Version:	1.0
+ */
+
+#ifndef STAMPS_H
+#define STAMPS_H
+
+#include <stddef.h>
+
+/* Default path of the stamps log. */
+#define STAMPS_LOG ".mmake_stamps"
+
+typedef struct stamps_log stamps_log;
+
+/**
+ * Loads the recorded digests. The file is only created once something is
+ * recorded. The caller is responsible for closing the log with
+ * stamps_log_close.
+ *
+ * @param path	Path of the stamps log.
+ * @return		The log, or NULL if out of memory.
+ */
+stamps_log *stamps_log_open(const char *path);
+
+/**
+ * Checks whether the contents of a prerequisite differ from when its
+ * target was last built.
+ *
+ * @param log		The stamps log.
+ * @param target	The target.
+ * @param prereq	The prerequisite.
+ * @return			0 if the contents are unchanged, 1 if they changed or no
+ *					digest was recorded for the pair.
+ */
+int stamps_log_changed(stamps_log *log, const char *target, const char *prereq);
+
+/**
+ * Records the digests of the current contents of some of a target's
+ * prerequisites, replacing what was recorded for the target before.
+ * Prerequisites that cannot be read are left out.
+ *
+ * @param log		The stamps log.
+ * @param target	The target that was built.
+ * @param prereq	The prerequisites to record.
+ * @param n_prereq	Number of prerequisites, possibly 0.
+ * @return			0 on success, 1 if out of memory.
+ */
+int stamps_log_record(stamps_log *log, const char *target, const char **prereq, size_t n_prereq);
+
+/**
+ * Writes the log back if anything was recorded, then frees it.
+ *
+ * @param log	The stamps log, or NULL.
+ */
+void stamps_log_close(stamps_log *log);
+
+#endif
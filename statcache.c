@@ -0,0 +1,104 @@
+/**
+ * statcache.c - Remembers the results of stat for the duration of a build.
+ *
+ * Results of paths found are kept in a map from path to entry. Paths that
+ * are targets of a rule, or were not found, get no entry and are counted
+ * as misses on every lookup.
+ *
+ * Functions:
+ *  - statcache_new(): Creates an empty cache.
+ *  - statcache_count(): Counts the hits and misses of a cache.
+ *  - statcache_stat(): Stats a path, using the cached result if any.
+ *  - statcache_del(): Frees the cache.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-29
+ * @Version:	1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "statcache.h"
+#include "strmap.h"
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct stat_entry {
+	struct stat_entry *next;
+	struct statx stx;
+	char path[];
+};
+
+struct statcache {
+	makefile *mmakefile;
+	strmap *entries;
+	struct stat_entry *all;
+	metrics_counters *counters;
+};
+
+/* -------------------------- External functions -------------------------- */
+
+statcache *statcache_new(makefile *mmakefile) {
+	statcache *cache = calloc(1, sizeof *cache);
+	if(cache == NULL) {
+		return NULL;
+	}
+	if((cache->entries = strmap_new()) == NULL) {
+		free(cache);
+		return NULL;
+	}
+	cache->mmakefile = mmakefile;
+	return cache;
+}
+
+void statcache_count(statcache *cache, metrics_counters *counters) {
+	cache->counters = counters;
+}
+
+int statcache_stat(statcache *cache, const char *path, struct statx *stx) {
+	struct stat_entry *entry = strmap_get(cache->entries, path);
+	if(entry != NULL) {
+		metrics_add(cache->counters, METRIC_STAT_HITS, 1);
+		*stx = entry->stx;
+		return 0;
+	}
+
+	metrics_add(cache->counters, METRIC_STAT_MISSES, 1);
+	if(statx(AT_FDCWD, path, 0, STATCACHE_MASK, stx) == -1) {
+		return -1;
+	}
+
+	// Commands may rewrite any target, so only plain files are kept
+	if(makefile_rule(cache->mmakefile, path) != NULL) {
+		return 0;
+	}
+	size_t len = strlen(path);
+	if((entry = malloc(sizeof *entry + len + 1)) == NULL) {
+		return 0;
+	}
+	memcpy(entry->path, path, len + 1);
+	entry->stx = *stx;
+	if(strmap_put(cache->entries, entry->path, entry) == 1) {
+		free(entry);
+		return 0;
+	}
+	entry->next = cache->all;
+	cache->all = entry;
+	return 0;
+}
+
+void statcache_del(statcache *cache) {
+	if(cache == NULL) {
+		return;
+	}
+
+	struct stat_entry *entry = cache->all;
+	while(entry != NULL) {
+		struct stat_entry *next = entry->next;
+		free(entry);
+		entry = next;
+	}
+	strmap_del(cache->entries);
+	free(cache);
+}
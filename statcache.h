@@ -0,0 +1,73 @@
+/**
+ * statcache.h - Remembers the results of stat for the duration of a build.
+ *
+ * handle_target stats the same files again and again: a prerequisite
+ * shared by many rules is checked once per rule. The cache keeps the first
+ * result for each path. Only plain files are cached: a path that is the
+ * target of a rule is statted on every lookup, since commands rewrite
+ * targets, and not only their own, as a side effect. So is a path that
+ * does not exist, since a command may create it. Files are looked up with
+ * statx, asking only for the fields staleness checks need.
+ *
+ * Hits and misses can be counted in the metrics.
+ *
+ * Functions:
+ *  - statcache_new(): Creates an empty cache.
+ *  - statcache_count(): Counts the hits and misses of a cache.
+ *  - statcache_stat(): Stats a path, using the cached result if any.
+ *  - statcache_del(): Frees the cache.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-29
+ * @Version:	1.0
+ */
+
+#ifndef STATCACHE_H
+#define STATCACHE_H
+
+#include <sys/stat.h>
+#include "metrics.h"
+#include "parser.h"
+
+/* Fields of struct statx filled in by the cache. */
+#define STATCACHE_MASK (STATX_TYPE | STATX_SIZE | STATX_MTIME)
+
+struct statx;
+typedef struct statcache statcache;
+
+/**
+ * Creates an empty cache. The caller is responsible for freeing it with
+ * statcache_del.
+ *
+ * @param mmakefile	The makefile whose targets are never cached. It must
+ *					outlive the cache.
+ * @return			The cache, or NULL if out of memory.
+ */
+statcache *statcache_new(makefile *mmakefile);
+
+/**
+ * Counts the hits and misses of a cache in the metrics from now on.
+ *
+ * @param cache		The cache.
+ * @param counters	Block of the thread calling statcache_stat, or NULL.
+ */
+void statcache_count(statcache *cache, metrics_counters *counters);
+
+/**
+ * Stats a path, or returns the result cached from an earlier call.
+ *
+ * @param cache	The cache.
+ * @param path	The path to stat.
+ * @param stx	Filled with the fields in STATCACHE_MASK on success.
+ * @return		0 on success, otherwise -1 with errno set as by statx.
+ */
+int statcache_stat(statcache *cache, const char *path, struct statx *stx);
+
+/**
+ * Frees the memory of a cache.
+ *
+ * @param cache	The cache, or NULL.
+ */
+void statcache_del(statcache *cache);
+
+#endif
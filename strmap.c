@@ -0,0 +1,168 @@
+/**
+ * strmap.c - Hash table from strings to pointers.
+ *
+ * Open addressing with linear probing over a power-of-two sized table.
+ * The table grows when it becomes more than half full. Entries are never
+ * removed, which keeps probing simple. A map created by strmap_wrap does
+ * not own its table until it grows.
+ *
+ * Functions:
+ *  - strmap_new(): Creates an empty map.
+ *  - strmap_wrap(): Creates a map over a table built elsewhere.
+ *  - strmap_get(): Looks up the value stored for a key.
+ *  - strmap_put(): Stores a value for a key.
+ *  - strmap_count(): Returns the number of keys in the map.
+ *  - strmap_table(): Returns the table of a map, to be saved elsewhere.
+ *  - strmap_del(): Frees the map.
+ *  - find_slot(): Finds the slot holding, or able to hold, a key.
+ *  - grow(): Doubles the capacity of the table.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-21
+ * @Version:	1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "hash.h"
+#include "strmap.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+#define INITIAL_CAPACITY 64
+
+/* ------------------------------ Structures ------------------------------- */
+
+struct strmap {
+	strmap_entry *entries;
+	size_t capacity;
+	size_t count;
+	int owns_entries;
+};
+
+/* ------------------ Declarations of internal functions ------------------ */
+
+static strmap_entry *find_slot(strmap_entry *entries, size_t capacity, const char *key, uint64_t hash);
+static int grow(strmap *map);
+
+/* -------------------------- External functions -------------------------- */
+
+strmap *strmap_new(void) {
+	strmap *map = malloc(sizeof *map);
+	if(map == NULL) {
+		return NULL;
+	}
+	map->capacity = INITIAL_CAPACITY;
+	map->count = 0;
+	map->owns_entries = 1;
+	map->entries = calloc(map->capacity, sizeof *map->entries);
+	if(map->entries == NULL) {
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+strmap *strmap_wrap(strmap_entry *entries, size_t capacity, size_t count) {
+	strmap *map = malloc(sizeof *map);
+	if(map == NULL) {
+		return NULL;
+	}
+	map->entries = entries;
+	map->capacity = capacity;
+	map->count = count;
+	map->owns_entries = 0;
+	return map;
+}
+
+void *strmap_get(strmap *map, const char *key) {
+	strmap_entry *e = find_slot(map->entries, map->capacity, key, hash_str(key));
+	return e->key != NULL ? e->value : NULL;
+}
+
+int strmap_put(strmap *map, const char *key, void *value) {
+	if(2 * (map->count + 1) > map->capacity && grow(map) == 1) {
+		return 1;
+	}
+
+	uint64_t hash = hash_str(key);
+	strmap_entry *e = find_slot(map->entries, map->capacity, key, hash);
+	if(e->key == NULL) {
+		e->hash = hash;
+		map->count++;
+	}
+	e->key = key;
+	e->value = value;
+	return 0;
+}
+
+size_t strmap_count(strmap *map) {
+	return map->count;
+}
+
+const strmap_entry *strmap_table(strmap *map, size_t *capacity) {
+	*capacity = map->capacity;
+	return map->entries;
+}
+
+void strmap_del(strmap *map) {
+	if(map == NULL) {
+		return;
+	}
+	if(map->owns_entries) {
+		free(map->entries);
+	}
+	free(map);
+}
+
+/* -------------------------- Internal functions -------------------------- */
+
+/**
+ * Finds the slot holding a key, or the empty slot where it would be stored.
+ *
+ * @param entries	The table to search.
+ * @param capacity	Number of slots in the table, a power of two.
+ * @param key		The key to find.
+ * @param hash		Hash of the key.
+ * @return			Pointer to the matching or empty slot.
+ */
+static strmap_entry *find_slot(strmap_entry *entries, size_t capacity, const char *key, uint64_t hash) {
+	size_t index = hash & (capacity - 1);
+	while(entries[index].key != NULL) {
+		if(entries[index].hash == hash && strcmp(entries[index].key, key) == 0) {
+			break;
+		}
+		index = (index + 1) & (capacity - 1);
+	}
+	return &entries[index];
+}
+
+/**
+ * Doubles the capacity of the table and rehashes all entries.
+ *
+ * @param map	The map to grow.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int grow(strmap *map) {
+	size_t capacity = map->capacity * 2;
+	strmap_entry *entries = calloc(capacity, sizeof *entries);
+	if(entries == NULL) {
+		return 1;
+	}
+
+	for(size_t i = 0; i < map->capacity; i++) {
+		strmap_entry *old = &map->entries[i];
+		if(old->key != NULL) {
+			*find_slot(entries, capacity, old->key, old->hash) = *old;
+		}
+	}
+
+	if(map->owns_entries) {
+		free(map->entries);
+	}
+	map->entries = entries;
+	map->capacity = capacity;
+	map->owns_entries = 1;
+	return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * strmap.h - Hash table from strings to pointers.
+ *
+ * A small open-addressing hash table used wherever mmake needs to look
+ * things up by name (rules by target, cached strings, ...). Keys are not
+ * copied; the caller must keep them alive for as long as the map is used.
+ *
+ * Functions:
+ *  - strmap_new(): Creates an empty map.
+ *  - strmap_wrap(): Creates a map over a table built elsewhere.
+ *  - strmap_get(): Looks up the value stored for a key.
+ *  - strmap_put(): Stores a value for a key.
+ *  - strmap_count(): Returns the number of keys in the map.
+ *  - strmap_table(): Returns the table of a map, to be saved elsewhere.
+ *  - strmap_del(): Frees the map.
+ *
+ * @Author:		Rasmus Mikaelsson (et24rmn)
+ * @Date:		2025-10-21
+ * @Version:	1.0
+ */
+
+#ifndef STRMAP_H
+#define STRMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct strmap strmap;
+
+/*
+ * A slot of the table. Empty slots have a NULL key. Exposed so a table can
+ * be saved, such as in a makefile image, and used again with strmap_wrap;
+ * its layout depends on hash_str and the probing in strmap.c.
+ */
+typedef struct strmap_entry {
+	const char *key;
+	void *value;
+	uint64_t hash;
+} strmap_entry;
+
+/**
+ * Creates an empty map. The caller is responsible for freeing the map
+ * with strmap_del.
+ *
+ * @return	A pointer to the new map, or NULL if out of memory.
+ */
+strmap *strmap_new(void);
+
+/**
+ * Creates a map over a table built elsewhere, as returned by strmap_table,
+ * without rehashing it. The table is not copied; it must outlive the map,
+ * unless the map grows and moves its entries to memory of its own. The
+ * caller is responsible for freeing the map with strmap_del.
+ *
+ * @param entries	The table.
+ * @param capacity	Number of slots, a power of two.
+ * @param count		Number of slots in use, less than capacity.
+ * @return			A pointer to the new map, or NULL if out of memory.
+ */
+strmap *strmap_wrap(strmap_entry *entries, size_t capacity, size_t count);
+
+/**
+ * Looks up the value stored for a key.
+ *
+ * @param map	The map to search.
+ * @param key	The key to look up.
+ * @return		The stored value, or NULL if the key is not in the map.
+ */
+void *strmap_get(strmap *map, const char *key);
+
+/**
+ * Stores a value for a key, replacing any previous value. The map then
+ * refers to the new key, so the previous key may be freed.
+ *
+ * @param map	The map to update.
+ * @param key	The key. It is not copied and must outlive the map.
+ * @param value	The value to store.
+ * @return		0 on success, 1 if out of memory.
+ */
+int strmap_put(strmap *map, const char *key, void *value);
+
+/**
+ * Returns the number of keys in the map.
+ *
+ * @param map	The map.
+ * @return		The number of keys.
+ */
+size_t strmap_count(strmap *map);
+
+/**
+ * Returns the table of a map, for saving it to be used with strmap_wrap.
+ *
+ * @param map		The map.
+ * @param capacity	Filled with the number of slots.
+ * @return			The table, valid until the map is changed.
+ */
+const strmap_entry *strmap_table(strmap *map, size_t *capacity);
+
+/**
+ * Frees the memory of a map. Keys and values are not freed.
+ *
+ * @param map	The map to free.
+ */
+void strmap_del(strmap *map);
+
+#endif
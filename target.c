@@ -5,12 +5,53 @@
  * prerequisites need to be rebuilt, based on modification times and
  * user-specified build flags.
  *
+ * Modification times are compared to the nanosecond. Where they cannot
+ * decide (a file dated in the future, or a file with whole-second times
+ * modified in the same second as its target) the contents recorded in the
+ * stamps log decide instead.
+ *
+ * Commands are submitted to the executor without waiting for them, so the
+ * commands of independent targets, such as the prerequisites of one
+ * target, run at the same time on an executor with several workers. The
+ * targets of a command in flight are flagged as running; a target waits
+ * for its running prerequisites, collecting whichever results come in
+ * first, before comparing times with them.
+ *
+ * Targets whose command timed out are recorded in the failed set, as are
+ * the targets depending on them once their prerequisites are handled, so
+ * each is tried only once and the rest of the build carries on.
+ *
+ * Progress is counted with plain stores into the build thread's own block
+ * of counters, and targets counted as done are flagged in an array of the
+ * build's own, indexed by rule, so no lookups are needed and the makefile
+ * is never written to; without counters none of it happens.
+ *
  * Functions:
  *  - handle_target(): Handles recursive target checking and rebuild logic.
- *  - exec_args(): Executes a target's command arguments.
  *  - file_exists(): Checks if a target file exists.
+ *  - stat_file(): Stats a file, through the stat cache if there is one.
  *  - updated_prereq(): Determines if any prerequisites are newer than the target.
- *  - rebuild_target(): Forks and executes rebuild commands for a target.
+ *  - compare_mtime(): Compares the modification times of a prerequisite and target.
+ *  - in_future(): Checks whether a modification time lies in the future.
+ *  - record_stamps(): Records the contents of suspect prerequisites.
+ *  - flush_batches(): Builds all targets still waiting in batches.
+ *  - wait_commands(): Waits for every command in flight.
+ *  - handle_discovered(): Handles prerequisites discovered from depfiles.
+ *  - finish_target(): Records depfile deps and caches a freshly built target.
+ *  - flush_prereq_batches(): Builds the batches holding any of a rule's prerequisites.
+ *  - wait_prereqs(): Waits for the commands building any of a rule's prerequisites.
+ *  - run_batch(): Submits the commands of a batch.
+ *  - submit_command(): Submits a rebuild command to the executor.
+ *  - collect_command(): Collects the result of a command and finishes its targets.
+ *  - free_in_flight(): Frees a command in flight.
+ *  - command_timeout(): Determines the timeout of a rebuild command.
+ *  - mark_failed(): Records a target as failed.
+ *  - mark_done(): Counts a target as done, once.
+ *  - is_failed(): Checks whether a target timed out or depends on one that did.
+ *  - any_failed(): Checks whether any of a rule's prerequisites failed.
+ *  - any_planned(): Checks whether a dry run plans to rebuild a prerequisite.
+ *  - report_error(): Reports an error through the progress callbacks.
+ *  - report_finished(): Reports that a command has run and its targets are counted.
  *
  * @Author:		Rasmus Mikaelsson (et24rmn)
  * @Date:		2025-10-07
@@ -19,67 +60,325 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 #include "target.h"
+#include "artifact.h"
+#include "batch.h"
+#include "deps.h"
+
+/* ------------------------------- Constants ------------------------------- */
+
+/* Results of compare_mtime. */
+#define MTIME_OLDER 0
+#define MTIME_NEWER 1
+#define MTIME_UNSURE 2
+
+/* ------------------------------ Structures ------------------------------- */
+
+/*
+ * A command in flight on the executor, and the targets it builds. The
+ * arguments are freed with it only if they were made for it, as for a
+ * batch.
+ */
+struct in_flight {
+	char **args;
+	int owns_args;
+	int batch;
+	const char **outputs;
+	rule **rules;
+	size_t n_targets;
+};
 
 /* ------------------ Declarations of internal functions ------------------ */
 
-static int updated_prereq(const char *target, const char **rule_prereq);
-static int exec_args(char **args);
-static int file_exists(const char *target);
-static int rebuild_target(char **args, int silence_commandes);
+static int updated_prereq(const char *target, const char **rule_prereq, const build_opts *opts);
+static int file_exists(const char *target, const build_opts *opts);
+static int stat_file(const char *path, struct statx *stx, const build_opts *opts);
+static int compare_mtime(const struct statx *target, const struct statx *prereq, const struct timespec *now);
+static int in_future(const struct statx *stx, const struct timespec *now);
+static void record_stamps(const char *target, rule *r, const build_opts *opts);
+static int handle_discovered(const char **discovered, makefile *mmakefile, const build_opts *opts);
+static void finish_target(const char *target, rule *r, const build_opts *opts);
+static int flush_prereq_batches(const char **rule_prereq, const build_opts *opts);
+static int wait_prereqs(const char **rule_prereq, makefile *mmakefile, const build_opts *opts);
+static int run_batch(batch_group *group, const build_opts *opts);
+static int submit_command(char **args, int owns_args, const char **inputs, const char **targets, rule **rules,
+	size_t n_targets, const build_opts *opts);
+static int collect_command(const build_opts *opts);
+static void free_in_flight(struct in_flight *f);
+static int command_timeout(const char **outputs, const build_opts *opts);
+static int mark_failed(rule *r, const build_opts *opts);
+static void mark_done(rule *r, const build_opts *opts);
+static int is_failed(const char *target, const build_opts *opts);
+static int any_failed(const char **rule_prereq, const build_opts *opts);
+static int any_planned(const char **rule_prereq, const build_opts *opts);
+static void report_error(const build_opts *opts, const char *target, const char *message);
+static void report_finished(const build_opts *opts, const char *target);
 
 /* -------------------------- External functions -------------------------- */
 
-int handle_target(const char *target, makefile *mmakefile, int force_build, int silence_commandes, FILE *fp) {
+int handle_target(const char *target, makefile *mmakefile, const build_opts *opts) {
 	rule *currentRule = makefile_rule(mmakefile, target);
 	if(currentRule == NULL) {
-		if(!file_exists(target)) {
-			fprintf(stderr, "%s: is not a file\n", target);
+		if(!file_exists(target, opts)) {
+			report_error(opts, target, "is not a file");
 			return 1;
 		}
 		return 0;
 	}
+
+	// A dry run visits every target it plans to rebuild only once
+	if(opts->planned != NULL && strmap_get(opts->planned, target) != NULL) {
+		return 0;
+	}
+	
+	// A target that timed out, or depends on one that did, is not retried
+	if(is_failed(target, opts)) {
+		return 0;
+	}
+
+	// A target already deferred to a batch is built when the batch runs
+	if(opts->batches != NULL && batch_pending(opts->batches, target)) {
+		return 0;
+	}
+
+	// A target whose command is in flight is waited for by its dependents
+	if(opts->running != NULL && opts->running[rule_index(currentRule)]) {
+		return 0;
+	}
 	
 	// Loop through prerequisites and recursively handle each one
 	const char **current_rule_prereqs = rule_prereq(currentRule);
 	int index = 0;
 	while(current_rule_prereqs[index] != NULL) {
-		if(handle_target(current_rule_prereqs[index], mmakefile, force_build, silence_commandes, fp) == 1) {
+		if(handle_target(current_rule_prereqs[index], mmakefile, opts) == 1) {
 			return 1;
 		}
 		index++;
 	}
+
+	// Prerequisites discovered from depfiles by earlier builds
+	const char **discovered = opts->deps != NULL ? deps_log_get(opts->deps, target) : NULL;
+	if(discovered != NULL && handle_discovered(discovered, mmakefile, opts) == 1) {
+		return 1;
+	}
+
+	// Prerequisites waiting in a batch must be built before they are compared
+	if(opts->batches != NULL && flush_prereq_batches(current_rule_prereqs, opts) == 1) {
+		return 1;
+	}
+
+	// And so must those whose commands are in flight
+	if(opts->running != NULL && (wait_prereqs(current_rule_prereqs, mmakefile, opts) == 1
+			|| (discovered != NULL && wait_prereqs(discovered, mmakefile, opts) == 1))) {
+		return 1;
+	}
+
+	// Targets depending on one that timed out are not built either
+	if(any_failed(current_rule_prereqs, opts) || (discovered != NULL && any_failed(discovered, opts))) {
+		return mark_failed(currentRule, opts);
+	}
 	
-	int is_updated_prereq = updated_prereq(target, current_rule_prereqs);
+	int is_updated_prereq = updated_prereq(target, current_rule_prereqs, opts);
+	if(is_updated_prereq == 0 && discovered != NULL) {
+		is_updated_prereq = updated_prereq(target, discovered, opts);
+	}
 	if(is_updated_prereq == 2) {
 		return 1;
 	}
 
+	// Targets depending on something a dry run would rebuild are stale too
+	if(is_updated_prereq == 0 && opts->planned != NULL) {
+		is_updated_prereq = any_planned(current_rule_prereqs, opts)
+			|| (discovered != NULL && any_planned(discovered, opts));
+	}
+
 	// Build project based parameters
 	char **args = rule_cmd(currentRule);
-	if(!file_exists(target) || force_build || is_updated_prereq) {
-		if(rebuild_target(args, silence_commandes) == 1) {
+	if(!file_exists(target, opts) || opts->force_build || is_updated_prereq) {
+		// A dry run only reports what it would run
+		if(opts->planned != NULL) {
+			if(opts->progress != NULL && opts->progress->command != NULL) {
+				opts->progress->command(opts->progress->ctx, target, args);
+			}
+			return strmap_put(opts->planned, rule_target(currentRule), currentRule);
+		}
+
+		// Restore from the artifact cache if this exact build has been done
+		// before, taking the target's discovered prerequisites from the entry
+		if(opts->artifact_dir != NULL && !opts->force_build) {
+			char key[ARTIFACT_KEY_LEN + 1];
+			char **restored_deps;
+			artifact_key(target, args, current_rule_prereqs, key);
+			if(artifact_restore(opts->artifact_dir, target, key, &restored_deps) == 0) {
+				if(opts->deps != NULL && deps_log_set(opts->deps, target, (const char **)restored_deps) == 1) {
+					report_error(opts, DEPS_LOG, strerror(errno));
+				}
+				free(restored_deps);
+				record_stamps(target, currentRule, opts);
+				mark_done(currentRule, opts);
+				if(opts->progress != NULL && opts->progress->restored != NULL) {
+					opts->progress->restored(opts->progress->ctx, target);
+				}
+				return 0;
+			}
+		}
+
+		// Batchable targets are collected and built together later
+		if(opts->batches != NULL && batch_defer(opts->batches, target, currentRule)) {
+			metrics_add(opts->counters, METRIC_QUEUE_DEPTH, 1);
+			return 0;
+		}
+
+		// The target is finished once the command's result is collected
+		const char *targets[] = { rule_target(currentRule) };
+		return submit_command(args, 0, current_rule_prereqs, targets, &currentRule, 1, opts);
+	}
+	mark_done(currentRule, opts);
+	return 0;
+}
+
+int flush_batches(const build_opts *opts) {
+	batch_group *group;
+	if(opts->batches == NULL) {
+		return 0;
+	}
+	while((group = batch_take_any(opts->batches)) != NULL) {
+		if(run_batch(group, opts) == 1) {
 			return 1;
 		}
 	}
 	return 0;
 }
 
+int wait_commands(const build_opts *opts) {
+	int result = 0;
+	while(opts->exec != NULL && executor_in_flight(opts->exec) > 0) {
+		if(collect_command(opts) == 1) {
+			result = 1;
+		}
+	}
+	return result;
+}
+
 /* -------------------------- Internal functions -------------------------- */
 
 /**
- * Executes a given list of command arguments.
- * 
- * @param args	Argument list
- * @return		0 if arguments was successfully executed, oterwise 1
+ * Handles the prerequisites of a target discovered from its depfile. Only
+ * those with a rule are handled; a discovered file that no longer exists
+ * simply makes the target stale instead of failing the build.
+ *
+ * @param discovered	The discovered prerequisites.
+ * @param mmakefile		Pointer to the parsed Makefile structure.
+ * @param opts			Build options
+ * @return				0 if successful, 1 if a rebuild fails.
  */
-static int exec_args(char **args) {
-	if(execvp(args[0], args) == -1) {
-		perror("execvp failed");
-		return 1;
+static int handle_discovered(const char **discovered, makefile *mmakefile, const build_opts *opts) {
+	int index = 0;
+	while(discovered[index] != NULL) {
+		if(makefile_rule(mmakefile, discovered[index]) != NULL
+				&& handle_target(discovered[index], mmakefile, opts) == 1) {
+			return 1;
+		}
+		index++;
+	}
+	if(opts->batches != NULL) {
+		return flush_prereq_batches(discovered, opts);
+	}
+	return 0;
+}
+
+/**
+ * Records the prerequisites listed in a freshly built target's depfile
+ * and the contents of its suspect prerequisites, and stores the target in
+ * the artifact cache if it is enabled. A depfile that cannot be read is
+ * reported, but does not fail the target.
+ *
+ * @param target	The target that was built.
+ * @param r			The rule of the target.
+ * @param opts		Build options
+ */
+static void finish_target(const char *target, rule *r, const build_opts *opts) {
+	int failed = opts->deps != NULL ? deps_log_update(opts->deps, target) : 0;
+	if(failed == 1) {
+		report_error(opts, target, "could not read depfile");
+	} else if(failed == 2) {
+		report_error(opts, DEPS_LOG, strerror(errno));
+	}
+	record_stamps(target, r, opts);
+	if(opts->artifact_dir != NULL) {
+		char key[ARTIFACT_KEY_LEN + 1];
+		artifact_key(target, rule_cmd(r), rule_prereq(r), key);
+		artifact_store(opts->artifact_dir, target, key,
+			opts->deps != NULL ? deps_log_get(opts->deps, target) : NULL);
+	}
+}
+
+/**
+ * Builds the batches holding any of a rule's prerequisites.
+ *
+ * @param rule_prereq	List of the given rules prerequisites
+ * @param opts			Build options
+ * @return				0 if all batches were built successfully, otherwise 1
+ */
+static int flush_prereq_batches(const char **rule_prereq, const build_opts *opts) {
+	int index = 0;
+	while(rule_prereq[index] != NULL) {
+		batch_group *group = batch_take(opts->batches, rule_prereq[index]);
+		if(group != NULL && run_batch(group, opts) == 1) {
+			return 1;
+		}
+		index++;
+	}
+	return 0;
+}
+
+/**
+ * Waits for the commands building any of a rule's prerequisites, finishing
+ * the targets of every command collected meanwhile.
+ *
+ * @param rule_prereq	List of the given rules prerequisites
+ * @param mmakefile		Pointer to the parsed Makefile structure.
+ * @param opts			Build options
+ * @return				0 if the commands collected succeeded or timed out,
+ *						otherwise 1
+ */
+static int wait_prereqs(const char **rule_prereq, makefile *mmakefile, const build_opts *opts) {
+	for(int index = 0; rule_prereq[index] != NULL; index++) {
+		rule *r = makefile_rule(mmakefile, rule_prereq[index]);
+		while(r != NULL && opts->running[rule_index(r)]) {
+			if(collect_command(opts) == 1) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Submits the commands of a batch. Each built target is stored in the
+ * artifact cache, if it is enabled, once its command is collected.
+ *
+ * @param group	The batch, taken from the batch set.
+ * @param opts	Build options
+ * @return		0 if every command was submitted, 1 if out of memory.
+ */
+static int run_batch(batch_group *group, const build_opts *opts) {
+	const char **targets;
+	rule **rules;
+	size_t n_targets;
+	char **args;
+
+	while((args = batch_next_cmd(group, &targets, &rules, &n_targets)) != NULL) {
+		metrics_add(opts->counters, METRIC_QUEUE_DEPTH, -(int64_t)n_targets);
+		if(submit_command(args, 1, NULL, targets, rules, n_targets, opts) == 1) {
+			return 1;
+		}
 	}
 	return 0;
 }
@@ -88,15 +387,27 @@ static int exec_args(char **args) {
  * Checks where or not a given target is a file
  *
  * @param target	Target to check
+ * @param opts		Build options, holding the stat cache.
  * @return			0 if target is not a file, otherwise 1
  */
-static int file_exists(const char *target) {	
-	FILE *check_file = fopen(target, "r");
-	if(check_file) {
-		fclose(check_file);
-		return 1;
+static int file_exists(const char *target, const build_opts *opts) {	
+	struct statx stx;
+	return stat_file(target, &stx, opts) == 0;
+}
+
+/**
+ * Stats a file, through the stat cache if the build has one.
+ *
+ * @param path	The file.
+ * @param stx	Filled with the fields in STATCACHE_MASK on success.
+ * @param opts	Build options, holding the stat cache.
+ * @return		0 on success, otherwise -1 with errno set.
+ */
+static int stat_file(const char *path, struct statx *stx, const build_opts *opts) {
+	if(opts->stats != NULL) {
+		return statcache_stat(opts->stats, path, stx);
 	}
-	return 0;
+	return statx(AT_FDCWD, path, 0, STATCACHE_MASK, stx);
 }
 
 /**
@@ -104,34 +415,42 @@ static int file_exists(const char *target) {
  *
  * @param target		The target file
  * @param rule_prereq	List of the given rules prerequisites
+ * @param opts			Build options, holding the stat cache
  * @return				1 if a rebuild is needed, 0 if "up-to-date", and 
  *						2 if error occures
  */
-static int updated_prereq(const char *target, const char **rule_prereq) {
-	struct stat target_mtime;
-	struct stat prereq_mtime;
+static int updated_prereq(const char *target, const char **rule_prereq, const build_opts *opts) {
+	struct statx target_mtime;
+	struct statx prereq_mtime;
+	struct timespec now;
 	
-	if(!file_exists(target)) {
+	if(!file_exists(target, opts)) {
 		return 1;
 	}
 	
-	if(stat(target, &target_mtime) == -1) {
-		perror("stat failed");
+	if(stat_file(target, &target_mtime, opts) == -1) {
+		report_error(opts, target, strerror(errno));
 		return 2;
 	}
+	clock_gettime(CLOCK_REALTIME, &now);
 	
 	// Check if any of the targets prerequisites are newer than the target
 	int index = 0;
 	while(rule_prereq[index] != NULL) {
-		if(!file_exists(rule_prereq[index])) {
+		if(!file_exists(rule_prereq[index], opts)) {
 			return 1;
 		}
-		if(stat(rule_prereq[index], &prereq_mtime) == -1) {
-			perror("stat failed");
+		if(stat_file(rule_prereq[index], &prereq_mtime, opts) == -1) {
+			report_error(opts, rule_prereq[index], strerror(errno));
 			return 2;
 		}
-		// If so, return true 
-		if(target_mtime.st_mtim.tv_sec < prereq_mtime.st_mtim.tv_sec) {
+		// If so, or if the times can't tell and the contents changed, return true 
+		int order = compare_mtime(&target_mtime, &prereq_mtime, &now);
+		if(order == MTIME_NEWER) {
+			return 1;
+		}
+		if(order == MTIME_UNSURE && (opts->stamps == NULL
+				|| stamps_log_changed(opts->stamps, target, rule_prereq[index]))) {
 			return 1;
 		}
 		index++;
@@ -140,44 +459,358 @@ static int updated_prereq(const char *target, const char **rule_prereq) {
 }
 
 /**
- * Rebuilds a given target by executing it's commands.
+ * Compares the modification times of a prerequisite and its target. Times
+ * in the future can't be compared, and neither can two times in the same
+ * second when one of them has no sub-second part, as on file systems that
+ * only keep whole seconds. Nor can two equal times: the kernel stamps
+ * files from a clock that only advances every few milliseconds, so a file
+ * written just after another may get the very same time.
  *
- *  @param args					Argument list for the rebuild command.
- *  @param silence_commandes	Silence flag. If true, suppresses command output.
- *  @return						0 if the target is rebuilt successfully, otherwise 1
+ * @param target	Status of the target.
+ * @param prereq	Status of the prerequisite.
+ * @param now		The current time.
+ * @return			MTIME_NEWER if the prerequisite is newer, MTIME_OLDER if
+ *					not, MTIME_UNSURE if the times can't tell.
  */
-static int rebuild_target(char **args, int silence_commandes) {
-	pid_t pid;
-	int status;
-	
-	// Silence commands handling
-	if(!silence_commandes) {
-		int index = 0;
-		while(args[index] != NULL) {
-			printf("%s", args[index]);
-			if(args[index + 1] != NULL) {
-				printf(" ");
+static int compare_mtime(const struct statx *target, const struct statx *prereq, const struct timespec *now) {
+	if(in_future(target, now) || in_future(prereq, now)) {
+		return MTIME_UNSURE;
+	}
+	if(prereq->stx_mtime.tv_sec != target->stx_mtime.tv_sec) {
+		return prereq->stx_mtime.tv_sec > target->stx_mtime.tv_sec ? MTIME_NEWER : MTIME_OLDER;
+	}
+	if(prereq->stx_mtime.tv_nsec == 0 || target->stx_mtime.tv_nsec == 0
+			|| prereq->stx_mtime.tv_nsec == target->stx_mtime.tv_nsec) {
+		return MTIME_UNSURE;
+	}
+	return prereq->stx_mtime.tv_nsec > target->stx_mtime.tv_nsec ? MTIME_NEWER : MTIME_OLDER;
+}
+
+/**
+ * Checks whether a modification time lies in the future.
+ *
+ * @param stx	Status of the file.
+ * @param now	The current time.
+ * @return		1 if the time is in the future, otherwise 0
+ */
+static int in_future(const struct statx *stx, const struct timespec *now) {
+	return stx->stx_mtime.tv_sec > now->tv_sec
+		|| (stx->stx_mtime.tv_sec == now->tv_sec && stx->stx_mtime.tv_nsec > now->tv_nsec);
+}
+
+/**
+ * Records the contents of the prerequisites of a freshly built target
+ * whose times can't order them against the target: those in the future,
+ * and those in the same second as the target where either time lacks a
+ * sub-second part or both are equal. If the target's own time is in the
+ * future, every prerequisite is recorded. Whole-second times alone are
+ * no reason, since many files get them on any file system (installed
+ * headers, for one); a prerequisite edited within the target's second
+ * later is still caught, having no stamp to match.
+ *
+ * @param target	The target that was built.
+ * @param r			The rule of the target.
+ * @param opts		Build options, holding the stamps log.
+ */
+static void record_stamps(const char *target, rule *r, const build_opts *opts) {
+	struct statx target_mtime;
+	struct statx prereq_mtime;
+	struct timespec now;
+	if(opts->stamps == NULL || stat_file(target, &target_mtime, opts) == -1) {
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	int all = in_future(&target_mtime, &now);
+
+	const char **lists[2] = { rule_prereq(r), opts->deps != NULL ? deps_log_get(opts->deps, target) : NULL };
+	size_t n_max = 0;
+	for(int l = 0; l < 2; l++) {
+		for(int index = 0; lists[l] != NULL && lists[l][index] != NULL; index++) {
+			n_max++;
+		}
+	}
+
+	const char **suspect = malloc((n_max + 1) * sizeof *suspect);
+	if(suspect == NULL) {
+		return;
+	}
+	size_t n = 0;
+	for(int l = 0; l < 2; l++) {
+		for(int index = 0; lists[l] != NULL && lists[l][index] != NULL; index++) {
+			if(stat_file(lists[l][index], &prereq_mtime, opts) == 0
+					&& (all || compare_mtime(&target_mtime, &prereq_mtime, &now) == MTIME_UNSURE)) {
+				suspect[n++] = lists[l][index];
 			}
-		index++;
 		}
-		printf("\n");
 	}
+	stamps_log_record(opts->stamps, target, suspect, n);
+	free(suspect);
+}
 
-	// Fork a new process
-	pid = fork();
-	if(pid < 0) {
-		perror("Fork failed");
+/**
+ * Submits a command rebuilding one or more targets to the executor, and
+ * flags the targets as running until it is collected.
+ *
+ *  @param args			Argument list for the rebuild command.
+ *  @param owns_args	If true, args is freed once the command is collected.
+ *  @param inputs		The command's input files, or NULL if not known.
+ *  @param targets		The targets the command builds.
+ *  @param rules		The rules of the targets.
+ *  @param n_targets	Number of targets.
+ *  @param opts			Build options, holding the executor and callbacks.
+ *  @return				0 if the command was submitted, 1 if out of memory.
+ */
+static int submit_command(char **args, int owns_args, const char **inputs, const char **targets, rule **rules,
+		size_t n_targets, const build_opts *opts) {
+	struct in_flight *f = calloc(1, sizeof *f);
+	if(f == NULL || (f->outputs = malloc((n_targets + 1) * sizeof *f->outputs)) == NULL
+			|| (f->rules = malloc(n_targets * sizeof *f->rules)) == NULL) {
+		report_error(opts, targets[0], "Out of memory");
+		if(f != NULL) {
+			free(f->outputs);
+			free(f);
+		}
+		if(owns_args) {
+			free(args);
+		}
 		return 1;
-	} else if(pid == 0) {
-		if(exec_args(args) == 1) {
-			return 1;
+	}
+	f->args = args;
+	f->owns_args = owns_args;
+	f->batch = owns_args;
+	memcpy(f->outputs, targets, n_targets * sizeof *f->outputs);
+	f->outputs[n_targets] = NULL;
+	memcpy(f->rules, rules, n_targets * sizeof *f->rules);
+	f->n_targets = n_targets;
+
+	job j = { .argv = args, .cwd = NULL, .inputs = inputs, .outputs = f->outputs };
+	j.timeout = command_timeout(f->outputs, opts);
+	if(opts->progress != NULL && opts->progress->command != NULL) {
+		opts->progress->command(opts->progress->ctx, targets[0], args);
+	}
+
+	metrics_add(opts->counters, METRIC_JOBS_RUNNING, 1);
+	for(size_t i = 0; i < n_targets; i++) {
+		opts->running[rule_index(rules[i])] = 1;
+	}
+	if(executor_submit(opts->exec, &j, f) == 1) {
+		for(size_t i = 0; i < n_targets; i++) {
+			opts->running[rule_index(rules[i])] = 0;
 		}
+		metrics_add(opts->counters, METRIC_JOBS_RUNNING, -1);
+		report_error(opts, targets[0], "Out of memory");
+		free_in_flight(f);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Waits for the first command in flight to finish, and finishes its
+ * targets: their depfiles, stamps and artifacts are recorded and they
+ * are counted as done. If the command timed out, whatever it left of the
+ * targets is removed and they are recorded as failed instead.
+ *
+ * @param opts	Build options, holding the executor and callbacks.
+ * @return		0 if the command succeeded or timed out, otherwise 1
+ */
+static int collect_command(const build_opts *opts) {
+	job_result result;
+	void *tag;
+	const build_progress *progress = opts->progress;
+
+	int run_failed = executor_collect(opts->exec, &result, &tag);
+	struct in_flight *f = tag;
+	metrics_add(opts->counters, METRIC_JOBS_RUNNING, -1);
+	if(f == NULL) {
+		report_error(opts, NULL, result.error != NULL ? result.error : "could not collect command");
+		job_result_free(&result);
+		return 1;
+	}
+	for(size_t i = 0; i < f->n_targets; i++) {
+		opts->running[rule_index(f->rules[i])] = 0;
 	}
 
-	// Wait for child and handel status
-	wait(&status);
-	if(WIFEXITED(status) && WEXITSTATUS(status) != EXIT_SUCCESS) {
+	if(run_failed == 1) {
+		report_error(opts, f->outputs[0], result.error != NULL ? result.error : "could not run command");
+		job_result_free(&result);
+		free_in_flight(f);
 		return 1;
 	}
+	metrics_add(opts->counters, METRIC_COMMANDS, 1);
+	if(result.spawn_us >= 0) {
+		metrics_add(opts->counters, METRIC_SPAWNS, 1);
+		metrics_add(opts->counters, METRIC_SPAWN_US, result.spawn_us);
+	}
+	// A killed command may leave a partial output newer than its inputs
+	for(int index = 0; result.timed_out && f->outputs[index] != NULL; index++) {
+		unlink(f->outputs[index]);
+	}
+	if(result.log != NULL && progress != NULL && progress->output != NULL) {
+		progress->output(progress->ctx, result.log, result.log_len);
+	}
+	int timed_out = result.timed_out;
+	int exit_code = result.exit_code;
+	job_result_free(&result);
+
+	int failed = 0;
+	if(timed_out && opts->failed != NULL) {
+		report_error(opts, f->outputs[0], f->batch ? "batch command timed out" : "command timed out");
+		for(size_t i = 0; i < f->n_targets && failed == 0; i++) {
+			failed = mark_failed(f->rules[i], opts);
+		}
+		report_finished(opts, f->outputs[0]);
+	} else if(timed_out || exit_code != EXIT_SUCCESS) {
+		report_error(opts, f->outputs[0], f->batch ? "batch command failed" : "command failed");
+		failed = 1;
+	} else {
+		for(size_t i = 0; i < f->n_targets; i++) {
+			finish_target(f->outputs[i], f->rules[i], opts);
+			mark_done(f->rules[i], opts);
+		}
+		report_finished(opts, f->outputs[0]);
+	}
+	free_in_flight(f);
+	return failed;
+}
+
+/**
+ * Frees a command in flight, and its arguments if it owns them.
+ *
+ * @param f	The command.
+ */
+static void free_in_flight(struct in_flight *f) {
+	if(f->owns_args) {
+		free(f->args);
+	}
+	free(f->outputs);
+	free(f->rules);
+	free(f);
+}
+
+/**
+ * Determines the timeout of a command: the one given for its target under
+ * .TIMEOUT, otherwise the one for every command. A command building
+ * several targets gets the longest of their timeouts.
+ *
+ * @param outputs	The targets the command builds.
+ * @param opts		Build options, holding the timeouts.
+ * @return			The timeout in seconds, or 0 for no limit.
+ */
+static int command_timeout(const char **outputs, const build_opts *opts) {
+	int timeout = 0;
+	for(int index = 0; outputs[index] != NULL; index++) {
+		const char *seconds = opts->timeouts != NULL ? strmap_get(opts->timeouts, outputs[index]) : NULL;
+		int target_timeout = seconds != NULL ? atoi(seconds) : opts->timeout;
+		if(target_timeout == 0) {
+			return 0;
+		}
+		if(target_timeout > timeout) {
+			timeout = target_timeout;
+		}
+	}
+	return timeout;
+}
+
+/**
+ * Records a target as failed, because its command timed out or it depends
+ * on a target that did.
+ *
+ * @param r		The rule of the target.
+ * @param opts	Build options, holding the failed targets.
+ * @return		0 on success, 1 if out of memory.
+ */
+static int mark_failed(rule *r, const build_opts *opts) {
+	metrics_add(opts->counters, METRIC_TARGETS_FAILED, 1);
+	return strmap_put(opts->failed, rule_target(r), r);
+}
+
+/**
+ * Counts a target as done, unless it has been counted before. Does
+ * nothing if the build has no counters.
+ *
+ * @param r		The rule of the target.
+ * @param opts	Build options, holding the counters and the done flags.
+ */
+static void mark_done(rule *r, const build_opts *opts) {
+	if(opts->counters == NULL || opts->done[rule_index(r)]) {
+		return;
+	}
+	opts->done[rule_index(r)] = 1;
+	metrics_add(opts->counters, METRIC_TARGETS_DONE, 1);
+}
+
+/**
+ * Checks whether a target timed out, or depends on a target that did.
+ * Costs nothing while no target has failed.
+ *
+ * @param target	The target.
+ * @param opts		Build options, holding the failed targets.
+ * @return			1 if the target failed, otherwise 0
+ */
+static int is_failed(const char *target, const build_opts *opts) {
+	return opts->failed != NULL && strmap_count(opts->failed) > 0
+		&& strmap_get(opts->failed, target) != NULL;
+}
+
+/**
+ * Checks whether any of a rule's prerequisites timed out, or depends on a
+ * target that did.
+ *
+ * @param rule_prereq	List of the given rules prerequisites
+ * @param opts			Build options, holding the failed targets.
+ * @return				1 if a prerequisite failed, otherwise 0
+ */
+static int any_failed(const char **rule_prereq, const build_opts *opts) {
+	if(opts->failed == NULL || strmap_count(opts->failed) == 0) {
+		return 0;
+	}
+	for(int index = 0; rule_prereq[index] != NULL; index++) {
+		if(strmap_get(opts->failed, rule_prereq[index]) != NULL) {
+			return 1;
+		}
+	}
 	return 0;
 }
+
+/**
+ * Checks whether a dry run plans to rebuild any of a rule's prerequisites.
+ *
+ * @param rule_prereq	List of the given rules prerequisites
+ * @param opts			Build options, holding the planned targets.
+ * @return				1 if a prerequisite is planned, otherwise 0
+ */
+static int any_planned(const char **rule_prereq, const build_opts *opts) {
+	for(int index = 0; rule_prereq[index] != NULL; index++) {
+		if(strmap_get(opts->planned, rule_prereq[index]) != NULL) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reports an error through the progress callbacks, if there are any.
+ *
+ * @param opts		Build options, holding the callbacks.
+ * @param target	The target the error concerns, or NULL.
+ * @param message	Description of the error.
+ */
+static void report_error(const build_opts *opts, const char *target, const char *message) {
+	if(opts->progress != NULL && opts->progress->error != NULL) {
+		opts->progress->error(opts->progress->ctx, target, message);
+	}
+}
+
+/**
+ * Reports, through the progress callbacks, that a command has run and the
+ * targets it built, or failed to build, have been counted.
+ *
+ * @param opts		Build options, holding the callbacks.
+ * @param target	The (first) target of the command.
+ */
+static void report_finished(const build_opts *opts, const char *target) {
+	if(opts->progress != NULL && opts->progress->finished != NULL) {
+		opts->progress->finished(opts->progress->ctx, target);
+	}
+}
@@ -7,6 +7,23 @@
  *
  * Functions:
  *  - handle_target(): Handels recursive target cehcking and rebuild logic.
+ *  - flush_batches(): Builds targets still waiting in batches.
+ *  - wait_commands(): Waits for every command in flight.
+ *
+ * A command may be given a time limit, for every rule with -t or for
+ * single rules with the special target .TIMEOUT, whose first
+ * prerequisite is the number of seconds and the rest are the targets:
+ *
+ *      .TIMEOUT: 60 test_net test_db
+ *
+ * A target whose command times out fails without stopping the build;
+ * the targets depending on it are not built, everything else is.
+ *
+ * If the build has counters, its progress is counted in them; see
+ * metrics.h.
+ *
+ * Nothing is printed by this module; commands, their output and errors are
+ * reported through the callbacks in build_progress.
  *
  * @Author:		Rasmus Mikaelsson (et24rmn)
  * @Date:		2025-10-07
@@ -17,18 +34,119 @@
 #define TARGET_H
 
 #include "parser.h"
+#include "executor.h"
+#include "batch.h"
+#include "deps.h"
+#include "strmap.h"
+#include "statcache.h"
+#include "stamps.h"
+#include "metrics.h"
+
+/* Special target giving the timeout of the commands of some targets. */
+#define TIMEOUT_TARGET ".TIMEOUT"
+
+/**
+ * Callbacks reporting the progress of a build. Any of them may be NULL.
+ *
+ * command		Called before a command runs, or for each command of a plan.
+ * output		Called with output of a command captured by the executor.
+ * finished		Called after a command has run and its targets are counted as
+ *				done or failed.
+ * restored		Called when a target is restored from the artifact cache.
+ * error		Called on errors, with the file or target concerned, or NULL.
+ * tick			Called every second while a build with metrics runs, from a
+ *				thread of its own, so that progress can be shown even while
+ *				a long command runs.
+ * ctx			Passed as the first argument of every callback.
+ */
+typedef struct build_progress {
+	void (*command)(void *ctx, const char *target, char **argv);
+	void (*output)(void *ctx, const char *log, size_t len);
+	void (*finished)(void *ctx, const char *target);
+	void (*restored)(void *ctx, const char *target);
+	void (*error)(void *ctx, const char *target, const char *message);
+	void (*tick)(void *ctx);
+	void *ctx;
+} build_progress;
+
+/**
+ * Options controlling how targets are built.
+ *
+ * force_build		Force build flag. If true, always rebuilds the target.
+ * artifact_dir		Directory of the artifact cache, or NULL if disabled.
+ * exec				Executor that runs the commands.
+ * batches			Targets deferred to batches, or NULL if batching is disabled.
+ * deps				Log of prerequisites discovered from depfiles, or NULL.
+ * planned			If not NULL, nothing is run: the targets that would be
+ *					rebuilt are reported and recorded here instead.
+ * progress			Callbacks reporting the progress, or NULL.
+ * stats			Cache of file status, or NULL to stat files every time.
+ * stamps			Contents of prerequisites with unreliable times, or NULL to
+ *					rebuild whenever the times can't tell.
+ * timeout			Seconds any command may run before it is killed, or 0.
+ * timeouts			Timeouts of single targets, overriding timeout, or NULL.
+ *					The values are the seconds as strings, as in .TIMEOUT.
+ * failed			Targets whose command timed out and the targets depending
+ *					on them, or NULL to stop the build when a command times out.
+ * counters			Block of counters to count the progress in, or NULL.
+ * done				Flags of the targets counted as done, indexed by rule_index,
+ *					so that targets handled more than once count once. Must
+ *					hold makefile_rule_count zeroed flags if counters is set.
+ * running			Flags of the targets whose commands are in flight, indexed
+ *					by rule_index. Must hold makefile_rule_count zeroed flags
+ *					if exec is set.
+ */
+typedef struct build_opts {
+	int force_build;
+	const char *artifact_dir;
+	executor *exec;
+	batch_set *batches;
+	deps_log *deps;
+	strmap *planned;
+	const build_progress *progress;
+	statcache *stats;
+	stamps_log *stamps;
+	int timeout;
+	strmap *timeouts;
+	strmap *failed;
+	metrics_counters *counters;
+	unsigned char *done;
+	unsigned char *running;
+} build_opts;
 
 /**
- * Determines if a target or its prerequisites need rebuilding.
+ * Determines if a target or its prerequisites need rebuilding. Targets of
+ * batchable rules may be deferred rather than built; they are built once a
+ * target depending on them is handled, or by flush_batches. Commands are
+ * left in flight on the executor, so that independent targets build at
+ * the same time; a target waits for the commands of its prerequisites,
+ * and wait_commands for all that are left. Targets that
+ * time out, and the targets depending on them, are recorded in
+ * opts->failed if it is set, and are not errors.
  *
  * @param target			The name of the target to handle.
  * @param mmakefile			Pointer to the parsed Makefile structure.
- * @param force_build		Force build flag. If true, always rebuilds the target.
- * @param silence_commands	Silence commands flag. If true, suppresses command output.
- * @param fp				File pointer for output (unused here but may be used elsewhere).
+ * @param opts				Options controlling the build.
  *
  * @return				0 if successful, 1 if an error occurs or a rebuild fails.
  */
-int handle_target(const char *target, makefile *mmakefile, int force_build, int silence_commands, FILE *fp);
+int handle_target(const char *target, makefile *mmakefile, const build_opts *opts);
+
+/**
+ * Builds all targets that are still waiting in batches.
+ *
+ * @param opts	Options controlling the build.
+ * @return		0 if successful, 1 if a rebuild fails.
+ */
+int flush_batches(const build_opts *opts);
+
+/**
+ * Waits for every command still in flight, finishing the targets of each.
+ * Carries on after a failed command, so that none is left running.
+ *
+ * @param opts	Options controlling the build.
+ * @return		0 if successful, 1 if a command failed.
+ */
+int wait_commands(const build_opts *opts);
 
 #endif